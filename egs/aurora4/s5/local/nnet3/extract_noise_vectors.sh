@@ -55,19 +55,11 @@ if [ $stage -le 11 ]; then
   noise_vec_dir=exp/nnet3/noise_${train_set}_sp_hires_offline
   mkdir -p $noise_vec_dir
   
-  compute-noise-vector scp:data/${train_set}_sp_hires/feats.scp scp:$targets_dir/targets.scp \
-    ark,scp:$noise_vec_dir/noise_vec.ark,$noise_vec_dir/noise_vec.scp
-  
-  base_feat_dim=$(feat-to-dim scp:data/${train_set}_sp_hires/feats.scp -) || exit 1;
-  start_dim=$base_feat_dim
-  noise_dim=$((2*base_feat_dim))
-  end_dim=$[$base_feat_dim+$noise_dim-1]
-
-  $train_cmd $targets_dir/log/duplicate_feats.log \
-    append-vector-to-feats scp:data/${train_set}_sp_hires/feats.scp ark:$noise_vec_dir/noise_vec.ark ark:- \| \
-    select-feats "$start_dim-$end_dim" ark:- ark:- \| \
-    subsample-feats --n=10 ark:- ark:- \| \
-    copy-feats --compress=true ark:- \
+  # The vectors are written once every 10 frames, as nnet3 reads online
+  # i-vectors.
+  $train_cmd $targets_dir/log/compute_noise_vectors.log \
+    compute-noise-vector --period=10 --compress=true \
+    scp:data/${train_set}_sp_hires/feats.scp scp:$targets_dir/targets.scp \
     ark,scp:$noise_vec_dir/ivector_online.ark,$noise_vec_dir/ivector_online.scp || exit 1;
 
   echo 10 > $noise_vec_dir/ivector_period
@@ -102,19 +94,11 @@ if [ $stage -le 13 ]; then
     noise_vec_dir=exp/nnet3/noise_${test_dir}_hires_offline
     mkdir -p $noise_vec_dir
     
-    compute-noise-vector scp:data/${test_dir}_hires/feats.scp scp:$targets_dir/targets.scp \
-      ark,scp:$noise_vec_dir/noise_vec.ark,$noise_vec_dir/noise_vec.scp
-    
-    base_feat_dim=$(feat-to-dim scp:data/${test_dir}_hires/feats.scp -) || exit 1;
-    start_dim=$base_feat_dim
-    noise_dim=$((2*base_feat_dim))
-    end_dim=$[$base_feat_dim+$noise_dim-1]
-
-    $train_cmd $targets_dir/log/duplicate_feats.log \
-      append-vector-to-feats scp:data/${test_dir}_hires/feats.scp ark:$noise_vec_dir/noise_vec.ark ark:- \| \
-      select-feats "$start_dim-$end_dim" ark:- ark:- \| \
-      subsample-feats --n=10 ark:- ark:- \| \
-      copy-feats --compress=true ark:- \
+    # The test targets are at 1/3 of the frame rate (see stage 12).
+    $train_cmd $targets_dir/log/compute_noise_vectors.log \
+      compute-noise-vector --period=10 --compress=true \
+      --target-subsampling-factor=3 \
+      scp:data/${test_dir}_hires/feats.scp scp:$targets_dir/targets.scp \
       ark,scp:$noise_vec_dir/ivector_online.ark,$noise_vec_dir/ivector_online.scp || exit 1;
 
     echo 10 > $noise_vec_dir/ivector_period
@@ -16,6 +16,9 @@ lang=
 lat_dir=
 type=offline
 nnet3_affix=
+frame_classifier=false  # If true, the test data is segmented with a frame
+                        # classifier trained on the training targets,
+                        # instead of decoding it with the GMM.
 
 . utils/parse_options.sh
 
@@ -61,7 +64,17 @@ if [ $stage -le 11 ]; then
   echo 10 > $noise_vec_dir/ivector_period
 fi
 
-if [ $stage -le 12 ]; then
+classifier=${segment_dir}/frame_classifier.mdl
+
+if [ $stage -le 12 ] && $frame_classifier; then
+  # Train a speech/non-speech frame classifier on the training targets,
+  # which replaces the decoding of the test data.
+  $train_cmd ${segment_dir}/log/train_frame_classifier.log \
+    train-frame-classifier scp:data/${train_set}_sp_hires/feats.scp \
+    scp:$targets_dir/targets.scp $classifier || exit 1;
+fi
+
+if [ $stage -le 12 ] && ! $frame_classifier; then
   # Segmentation for test data
   utils/mkgraph.sh data/lang_test_tgpr_5k \
     exp/$gmm exp/$gmm/graph_tgpr_5k || exit 1;
@@ -90,8 +103,16 @@ if [ $stage -le 13 ]; then
     noise_vec_dir=exp/nnet3/noise_${test_dir}_hires_mle
     mkdir -p $noise_vec_dir
     
-    compute-noise-vector-online scp:data/${test_dir}_hires/feats.scp scp:$targets_dir/targets.scp 10 \
-      ark,scp:${noise_vec_dir}/ivector_online.ark,${noise_vec_dir}/ivector_online.scp
+    if $frame_classifier; then
+      compute-noise-vector-online --frame-classifier=$classifier \
+        scp:data/${test_dir}_hires/feats.scp "" 10 \
+        ark,scp:${noise_vec_dir}/ivector_online.ark,${noise_vec_dir}/ivector_online.scp
+    else
+      # The test targets are at 1/3 of the frame rate (see stage 12).
+      compute-noise-vector-online --target-subsampling-factor=3 \
+        scp:data/${test_dir}_hires/feats.scp scp:$targets_dir/targets.scp 10 \
+        ark,scp:${noise_vec_dir}/ivector_online.ark,${noise_vec_dir}/ivector_online.scp
+    fi
     
     echo 10 > $noise_vec_dir/ivector_period
   done
@@ -0,0 +1,153 @@
+// ivector/noise-frame-classifier.cc
+
+// Copyright 2020   Johns Hopkins University (author: Desh Raj)
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <algorithm>
+
+#include "ivector/noise-frame-classifier.h"
+
+namespace kaldi {
+
+NoiseFrameClassifierStats::NoiseFrameClassifierStats(int32 dim):
+    count_(2), sum_(2, dim), sumsq_(2, dim) { }
+
+void NoiseFrameClassifierStats::AccStats(
+    const MatrixBase<BaseFloat> &feats,
+    const std::vector<bool> &silence_decisions) {
+  int32 num_rows = feats.NumRows();
+  KALDI_ASSERT(feats.NumCols() == Dim() &&
+               num_rows == static_cast<int32>(silence_decisions.size()));
+  if (num_rows == 0)
+    return;
+  // The sums are done with 0/1 masks, as in AccumulateSpeechNoiseStats().
+  Matrix<BaseFloat> masks(2, num_rows), feats_sq(feats);
+  for (int32 i = 0; i < num_rows; i++)
+    masks(silence_decisions[i] ? 1 : 0, i) = 1.0;
+  feats_sq.ApplyPow(2.0);
+  Matrix<BaseFloat> sum(2, Dim()), sumsq(2, Dim());
+  sum.AddMatMat(1.0, masks, kNoTrans, feats, kNoTrans, 0.0);
+  sumsq.AddMatMat(1.0, masks, kNoTrans, feats_sq, kNoTrans, 0.0);
+  Vector<BaseFloat> count(2);
+  count.AddColSumMat(1.0, masks, 0.0);
+  count_.AddVec(1.0, count);
+  sum_.AddMat(1.0, Matrix<double>(sum));
+  sumsq_.AddMat(1.0, Matrix<double>(sumsq));
+}
+
+void NoiseFrameClassifier::Estimate(const NoiseFrameClassifierStats &stats,
+                                    BaseFloat var_floor) {
+  int32 dim = stats.Dim();
+  double total_count = stats.count_.Sum();
+  if (dim == 0 || stats.count_(0) < 2.0 || stats.count_(1) < 2.0)
+    KALDI_ERR << "Not enough speech or non-speech frames to train the "
+              << "classifier (counts are " << stats.count_(0) << " and "
+              << stats.count_(1) << ").";
+  KALDI_ASSERT(var_floor >= 0.0);
+  // The variance of all the frames, for flooring.
+  Vector<double> global_mean(dim), global_var(dim);
+  global_mean.AddRowSumMat(1.0 / total_count, stats.sum_, 0.0);
+  global_var.AddRowSumMat(1.0 / total_count, stats.sumsq_, 0.0);
+  global_var.AddVec2(-1.0, global_mean);
+
+  inv_vars_.Resize(2, dim);
+  means_invvars_.Resize(2, dim);
+  gconsts_.Resize(2);
+  for (int32 c = 0; c < 2; c++) {
+    double count = stats.count_(c);
+    Vector<double> mean(stats.sum_.Row(c)), var(stats.sumsq_.Row(c));
+    mean.Scale(1.0 / count);
+    var.Scale(1.0 / count);
+    var.AddVec2(-1.0, mean);
+    int32 num_floored = 0;
+    for (int32 i = 0; i < dim; i++) {
+      double floor = std::max<double>(var_floor * global_var(i), 1.0e-10);
+      if (var(i) < floor) {
+        var(i) = floor;
+        num_floored++;
+      }
+    }
+    if (num_floored > 0)
+      KALDI_LOG << "Floored " << num_floored << " variances of the "
+                << (c == 0 ? "speech" : "non-speech") << " class.";
+    Vector<double> inv_var(var), mean_invvar(mean);
+    inv_var.InvertElements();
+    mean_invvar.MulElements(inv_var);
+    // log p(c) - 0.5 (d log(2 pi) + sum_i log var_i + sum_i mean_i^2 / var_i).
+    Vector<double> log_var(var);
+    log_var.ApplyLog();
+    gconsts_(c) = Log(count / total_count) -
+        0.5 * (dim * M_LOG_2PI + log_var.Sum() + VecVec(mean, mean_invvar));
+    inv_vars_.CopyRowFromVec(inv_var, c);
+    means_invvars_.CopyRowFromVec(mean_invvar, c);
+  }
+}
+
+void NoiseFrameClassifier::LogPosteriorRatios(
+    const MatrixBase<BaseFloat> &feats, Vector<BaseFloat> *ratios) const {
+  if (Dim() == 0)
+    KALDI_ERR << "Frame classifier has not been estimated.";
+  if (feats.NumCols() != Dim())
+    KALDI_ERR << "Feature dimension " << feats.NumCols() << " does not "
+              << "match the frame classifier (" << Dim() << ")";
+  int32 num_rows = feats.NumRows();
+  // As in DiagGmm::LogLikelihoods(), the log-likelihoods (plus log-priors)
+  // are gconst + x . (mean / var) - 0.5 x^2 . (1 / var).
+  Matrix<BaseFloat> loglikes(num_rows, 2, kUndefined), feats_sq(feats);
+  loglikes.CopyRowsFromVec(gconsts_);
+  loglikes.AddMatMat(1.0, feats, kNoTrans, means_invvars_, kTrans, 1.0);
+  feats_sq.ApplyPow(2.0);
+  loglikes.AddMatMat(-0.5, feats_sq, kNoTrans, inv_vars_, kTrans, 1.0);
+  ratios->Resize(num_rows, kUndefined);
+  ratios->CopyColFromMat(loglikes, 0);
+  Vector<BaseFloat> non_speech(num_rows, kUndefined);
+  non_speech.CopyColFromMat(loglikes, 1);
+  ratios->AddVec(-1.0, non_speech);
+}
+
+void NoiseFrameClassifier::Classify(const MatrixBase<BaseFloat> &feats,
+                                    BaseFloat speech_bias,
+                                    std::vector<bool> *silence_decisions) const {
+  Vector<BaseFloat> ratios;
+  LogPosteriorRatios(feats, &ratios);
+  int32 num_rows = ratios.Dim();
+  silence_decisions->resize(num_rows);
+  for (int32 i = 0; i < num_rows; i++)
+    (*silence_decisions)[i] = !(ratios(i) + speech_bias > 0.0);
+}
+
+void NoiseFrameClassifier::Write(std::ostream &os, bool binary) const {
+  WriteToken(os, binary, "<NoiseFrameClassifier>");
+  inv_vars_.Write(os, binary);
+  means_invvars_.Write(os, binary);
+  gconsts_.Write(os, binary);
+  WriteToken(os, binary, "</NoiseFrameClassifier>");
+}
+
+void NoiseFrameClassifier::Read(std::istream &is, bool binary) {
+  ExpectToken(is, binary, "<NoiseFrameClassifier>");
+  inv_vars_.Read(is, binary);
+  means_invvars_.Read(is, binary);
+  gconsts_.Read(is, binary);
+  ExpectToken(is, binary, "</NoiseFrameClassifier>");
+  if (inv_vars_.NumRows() != 2 || means_invvars_.NumRows() != 2 ||
+      means_invvars_.NumCols() != inv_vars_.NumCols() || gconsts_.Dim() != 2)
+    KALDI_ERR << "Invalid noise frame classifier.";
+}
+
+}  // namespace kaldi
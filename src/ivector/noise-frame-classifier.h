@@ -0,0 +1,102 @@
+// ivector/noise-frame-classifier.h
+
+// Copyright 2020   Johns Hopkins University (author: Desh Raj)
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef KALDI_IVECTOR_NOISE_FRAME_CLASSIFIER_H_
+#define KALDI_IVECTOR_NOISE_FRAME_CLASSIFIER_H_
+
+#include <string>
+#include <vector>
+
+#include "matrix/matrix-lib.h"
+#include "util/common-utils.h"
+#include "base/kaldi-error.h"
+
+namespace kaldi {
+
+/// Statistics for training a NoiseFrameClassifier: the count, sum and sum
+/// of squares of the speech and of the non-speech frames.
+class NoiseFrameClassifierStats {
+ public:
+  NoiseFrameClassifierStats() { }
+
+  explicit NoiseFrameClassifierStats(int32 dim);
+
+  int32 Dim() const { return sum_.NumCols(); }
+
+  /// Adds the frames of "feats"; silence_decisions[i] is true if frame i
+  /// is not speech (see FrameLabelsToSilenceDecisions()).
+  void AccStats(const MatrixBase<BaseFloat> &feats,
+                const std::vector<bool> &silence_decisions);
+
+ private:
+  friend class NoiseFrameClassifier;
+  // Row or element 0 is for speech, 1 for non-speech.
+  Vector<double> count_;
+  Matrix<double> sum_;
+  Matrix<double> sumsq_;
+};
+
+/// A small speech/non-speech frame classifier, used to get the silence
+/// decisions for noise vector estimation when there are no targets (e.g.
+/// on test data, instead of decoding to get them). Each class is
+/// modeled by one diagonal Gaussian, and a frame is classified as speech
+/// if the log-likelihood ratio of speech to non-speech, plus the log
+/// prior ratio and a bias, is positive. This costs two small
+/// matrix-matrix products per utterance.
+class NoiseFrameClassifier {
+ public:
+  NoiseFrameClassifier() { }
+
+  /// Estimates the model from the statistics. The variances are floored
+  /// to "var_floor" times the variance of all the frames.
+  void Estimate(const NoiseFrameClassifierStats &stats, BaseFloat var_floor);
+
+  int32 Dim() const { return inv_vars_.NumCols(); }
+
+  /// Outputs the log-posterior ratio of speech to non-speech for each
+  /// frame of "feats". It is an error if the feature dimension is not
+  /// Dim().
+  void LogPosteriorRatios(const MatrixBase<BaseFloat> &feats,
+                          Vector<BaseFloat> *ratios) const;
+
+  /// Outputs one decision per frame of "feats", true for frames that are
+  /// not speech. "speech_bias" is added to the log-posterior ratios before
+  /// the decision; positive values classify more frames as speech. A frame
+  /// is speech only if the biased ratio is strictly positive, so ties
+  /// count as non-speech, the same rule as for targets (see
+  /// IsSpeechTarget() in noise-vector-io.h).
+  void Classify(const MatrixBase<BaseFloat> &feats, BaseFloat speech_bias,
+                std::vector<bool> *silence_decisions) const;
+
+  void Write(std::ostream &os, bool binary) const;
+  void Read(std::istream &is, bool binary);
+
+ private:
+  // Row 0 is for speech, row 1 for non-speech: the inverse variances and
+  // the means times the inverse variances, and for each class the log
+  // prior plus the constant terms of the log-likelihood (cf. DiagGmm).
+  Matrix<BaseFloat> inv_vars_;
+  Matrix<BaseFloat> means_invvars_;
+  Vector<BaseFloat> gconsts_;
+};
+
+}  // namespace kaldi
+
+#endif  // KALDI_IVECTOR_NOISE_FRAME_CLASSIFIER_H_
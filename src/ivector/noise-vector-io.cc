@@ -0,0 +1,408 @@
+// ivector/noise-vector-io.cc
+
+// Copyright 2020  Johns Hopkins University (author: Desh Raj)
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+#include "ivector/noise-vector-io.h"
+
+namespace kaldi {
+
+void TargetsToFrameLabels(const MatrixBase<BaseFloat> &targets,
+                          std::vector<std::pair<int32, int32> > *labels) {
+  KALDI_ASSERT(targets.NumCols() == 3);
+  labels->clear();
+  for (int32 i = 0; i < targets.NumRows(); i++) {
+    BaseFloat sil = targets(i, kNoiseFrameSilence),
+        speech = targets(i, kNoiseFrameSpeech),
+        garbage = targets(i, kNoiseFrameGarbage);
+    int32 label;
+    if (IsSpeechTarget(sil, speech, garbage))
+      label = kNoiseFrameSpeech;
+    else if (garbage > sil)
+      label = kNoiseFrameGarbage;
+    else
+      label = kNoiseFrameSilence;
+    if (!labels->empty() && labels->back().first == label)
+      labels->back().second++;
+    else
+      labels->push_back(std::make_pair(label, 1));
+  }
+}
+
+int32 NumFramesInLabels(const std::vector<std::pair<int32, int32> > &labels) {
+  int32 num_frames = 0;
+  for (size_t i = 0; i < labels.size(); i++) {
+    if (labels[i].second < 0)
+      KALDI_ERR << "Invalid compact targets: negative segment length "
+                << labels[i].second;
+    num_frames += labels[i].second;
+  }
+  return num_frames;
+}
+
+void FrameLabelsToSilenceDecisions(
+    const std::vector<std::pair<int32, int32> > &labels,
+    std::vector<bool> *silence_decisions) {
+  silence_decisions->clear();
+  silence_decisions->reserve(NumFramesInLabels(labels));
+  for (size_t i = 0; i < labels.size(); i++)
+    silence_decisions->insert(silence_decisions->end(), labels[i].second,
+                              labels[i].first != kNoiseFrameSpeech);
+}
+
+void TargetsToSilenceDecisions(const MatrixBase<BaseFloat> &targets,
+                               std::vector<bool> *silence_decisions) {
+  KALDI_ASSERT(targets.NumCols() >= 3);
+  int32 num_frames = targets.NumRows();
+  silence_decisions->resize(num_frames);
+  for (int32 i = 0; i < num_frames; i++) {
+    const BaseFloat *t = targets.RowData(i);
+    (*silence_decisions)[i] = !IsSpeechTarget(t[kNoiseFrameSilence],
+                                              t[kNoiseFrameSpeech],
+                                              t[kNoiseFrameGarbage]);
+  }
+}
+
+void SubsampledToFrameDecisions(int32 subsampling_factor, int32 num_frames,
+                                std::vector<bool> *silence_decisions) {
+  KALDI_ASSERT(subsampling_factor > 0 &&
+               static_cast<int32>(silence_decisions->size()) ==
+               NumSubsampledFrames(num_frames, subsampling_factor));
+  if (subsampling_factor == 1)
+    return;
+  silence_decisions->resize(std::max<size_t>(num_frames,
+                                             silence_decisions->size()));
+  // Going backwards, each target frame is read before it is overwritten.
+  for (int32 t = num_frames - 1; t >= 0; t--)
+    (*silence_decisions)[t] = (*silence_decisions)[t / subsampling_factor];
+  silence_decisions->resize(num_frames);
+}
+
+bool CheckNumTargetFrames(const std::string &utt, int32 num_frames,
+                          int32 num_target_frames, int32 subsampling_factor,
+                          const std::string &fallback) {
+  if (NumSubsampledFrames(num_frames, subsampling_factor) == num_target_frames)
+    return true;
+  std::ostringstream hint;
+  for (int32 factor = 1; factor <= 10; factor++) {
+    if (factor != subsampling_factor &&
+        NumSubsampledFrames(num_frames, factor) == num_target_frames) {
+      hint << " (this matches --target-subsampling-factor=" << factor << ")";
+      break;
+    }
+  }
+  KALDI_WARN << "Mismatch in number for frames " << num_frames
+             << " for features and targets " << num_target_frames
+             << " with target subsampling factor " << subsampling_factor
+             << hint.str() << ", for utterance " << utt << fallback;
+  return false;
+}
+
+void SelectHeadTailRows(const MatrixBase<BaseFloat> &feats,
+                        int32 num_head, int32 num_tail,
+                        Matrix<BaseFloat> *rows) {
+  KALDI_ASSERT(num_head >= 0 && num_tail >= 0);
+  int32 num_rows = feats.NumRows(),
+      head_end = std::min(num_head, num_rows),
+      tail_start = std::max(head_end, num_rows - num_tail);
+  rows->Resize(head_end + num_rows - tail_start, feats.NumCols(), kUndefined);
+  if (head_end > 0)
+    rows->RowRange(0, head_end).CopyFromMat(feats.RowRange(0, head_end));
+  if (tail_start < num_rows)
+    rows->RowRange(head_end, num_rows - tail_start).CopyFromMat(
+        feats.RowRange(tail_start, num_rows - tail_start));
+}
+
+// Reads "num_bytes" bytes at "offset" of "is" and appends them to "os".
+static void CopyBytes(std::istream &is, std::streamoff offset,
+                      size_t num_bytes, std::ostream &os) {
+  if (num_bytes == 0)
+    return;
+  std::vector<char> buffer(num_bytes);
+  is.seekg(offset);
+  is.read(&(buffer[0]), num_bytes);
+  if (!is.good())
+    KALDI_ERR << "Error reading matrix rows.";
+  os.write(&(buffer[0]), num_bytes);
+}
+
+HeadTailRowReader::HeadTailRowReader(int32 num_head, int32 num_tail):
+    num_head_(num_head), num_tail_(num_tail) {
+  KALDI_ASSERT(num_head >= 0 && num_tail >= 0);
+}
+
+bool HeadTailRowReader::Read(const std::string &rxfilename,
+                             Matrix<BaseFloat> *rows, int32 *num_rows) {
+  if (ClassifyRxfilename(rxfilename) != kOffsetFileInput)
+    return false;
+  size_t pos = rxfilename.find_last_of(':');
+  std::string filename = rxfilename.substr(0, pos);
+  int64 offset;
+  // This fails for row or column ranges like "foo.ark:1234[0:9]".
+  if (!ConvertStringToInteger(rxfilename.substr(pos + 1), &offset))
+    return false;
+  if (filename != filename_ || !is_.is_open()) {
+    if (is_.is_open())
+      is_.close();
+    filename_.clear();
+    is_.clear();
+    is_.open(filename.c_str(), std::ios::in | std::ios::binary);
+    if (!is_.is_open())
+      return false;
+    filename_ = filename;
+  }
+  std::istream &is = is_;
+  is.clear();  // In case an earlier read hit the end of the file.
+  is.seekg(offset);
+  if (is.get() != '\0' || is.get() != 'B')
+    return false;  // Not in binary mode.
+
+  std::string token;
+  ReadToken(is, true, &token);
+  if (token == "FM" || token == "DM") {
+    int32 rows_in, cols;
+    ReadBasicType(is, true, &rows_in);
+    ReadBasicType(is, true, &cols);
+    int32 head_end = std::min(num_head_, rows_in),
+        tail_start = std::max(head_end, rows_in - num_tail_);
+    std::streamoff data_start = is.tellg();
+    size_t row_bytes = static_cast<size_t>(cols) *
+        (token == "FM" ? sizeof(float) : sizeof(double));
+    // Gather the rows in one buffer, then convert them.
+    std::ostringstream os;
+    CopyBytes(is, data_start, head_end * row_bytes, os);
+    CopyBytes(is, data_start + tail_start * row_bytes,
+              (rows_in - tail_start) * row_bytes, os);
+    std::string data = os.str();
+    int32 rows_out = head_end + rows_in - tail_start;
+    rows->Resize(rows_out, cols, kUndefined);
+    for (int32 r = 0; r < rows_out; r++) {
+      char *row_data = &(data[0]) + r * row_bytes;
+      if (token == "FM") {
+        SubVector<float> row(reinterpret_cast<float*>(row_data), cols);
+        rows->CopyRowFromVec(row, r);
+      } else {
+        SubVector<double> row(reinterpret_cast<double*>(row_data), cols);
+        rows->CopyRowFromVec(row, r);
+      }
+    }
+    *num_rows = rows_in;
+    return true;
+  } else if (token == "CM" || token == "CM2" || token == "CM3") {
+    // The header of CompressedMatrix, without the format (which is given
+    // by the token): min value, range, number of rows and of columns.
+    float min_value, range;
+    int32 rows_in, cols;
+    is.read(reinterpret_cast<char*>(&min_value), sizeof(min_value));
+    is.read(reinterpret_cast<char*>(&range), sizeof(range));
+    is.read(reinterpret_cast<char*>(&rows_in), sizeof(rows_in));
+    is.read(reinterpret_cast<char*>(&cols), sizeof(cols));
+    if (!is.good())
+      KALDI_ERR << "Error reading compressed matrix header from "
+                << rxfilename;
+    int32 head_end = std::min(num_head_, rows_in),
+        tail_start = std::max(head_end, rows_in - num_tail_),
+        rows_out = head_end + rows_in - tail_start;
+    std::streamoff data_start = is.tellg();
+    // We write a compressed matrix with only the rows we need, and let
+    // CompressedMatrix decode it. Each value is decoded independently
+    // given the global header (and the column header, for "CM"), so these
+    // carry over unchanged.
+    std::ostringstream os;
+    WriteToken(os, true, token);
+    os.write(reinterpret_cast<const char*>(&min_value), sizeof(min_value));
+    os.write(reinterpret_cast<const char*>(&range), sizeof(range));
+    os.write(reinterpret_cast<const char*>(&rows_out), sizeof(rows_out));
+    os.write(reinterpret_cast<const char*>(&cols), sizeof(cols));
+    if (token == "CM") {
+      // One byte per value, stored by columns after a header of four
+      // uint16 percentiles per column.
+      size_t col_header_bytes = 4 * sizeof(uint16) * cols;
+      CopyBytes(is, data_start, col_header_bytes, os);
+      std::streamoff col_start = data_start + col_header_bytes;
+      for (int32 c = 0; c < cols; c++, col_start += rows_in) {
+        CopyBytes(is, col_start, head_end, os);
+        CopyBytes(is, col_start + tail_start, rows_in - tail_start, os);
+      }
+    } else {
+      // Stored by rows, with two bytes ("CM2") or one byte ("CM3") per
+      // value.
+      size_t row_bytes = static_cast<size_t>(cols) *
+          (token == "CM2" ? sizeof(uint16) : sizeof(uint8));
+      CopyBytes(is, data_start, head_end * row_bytes, os);
+      CopyBytes(is, data_start + tail_start * row_bytes,
+                (rows_in - tail_start) * row_bytes, os);
+    }
+    std::istringstream compressed_is(os.str());
+    CompressedMatrix compressed;
+    compressed.Read(compressed_is, true);
+    rows->Resize(rows_out, cols, kUndefined);
+    compressed.CopyToMat(rows);
+    *num_rows = rows_in;
+    return true;
+  }
+  return false;
+}
+
+SequentialFeatureTargetReader::SequentialFeatureTargetReader(
+    const std::string &feat_rspecifier,
+    const std::string &target_rspecifier,
+    bool paired_read,
+    bool compact_targets):
+    paired_read_(paired_read), compact_targets_(compact_targets),
+    feat_reader_(feat_rspecifier), no_targets_(target_rspecifier.empty()),
+    has_targets_(false), num_extra_targets_(0) {
+  if (no_targets_)
+    return;
+  bool ok;
+  if (paired_read_) {
+    ok = (compact_targets_ ? sequential_label_reader_.Open(target_rspecifier)
+          : sequential_target_reader_.Open(target_rspecifier));
+    if (ok && !feat_reader_.Done()) {
+      prev_feat_key_ = feat_reader_.Key();
+      SyncTargets();
+    }
+  } else {
+    ok = (compact_targets_ ? random_label_reader_.Open(target_rspecifier)
+          : random_target_reader_.Open(target_rspecifier));
+  }
+  if (!ok)
+    KALDI_ERR << "Error opening targets " << target_rspecifier;
+}
+
+bool SequentialFeatureTargetReader::HasTargets() {
+  if (no_targets_)
+    return false;
+  if (paired_read_)
+    return has_targets_;
+  if (compact_targets_)
+    return random_label_reader_.HasKey(feat_reader_.Key());
+  return random_target_reader_.HasKey(feat_reader_.Key());
+}
+
+const Matrix<BaseFloat> &SequentialFeatureTargetReader::Targets() {
+  KALDI_ASSERT(!compact_targets_);
+  if (paired_read_) {
+    KALDI_ASSERT(has_targets_);
+    return sequential_target_reader_.Value();
+  }
+  return random_target_reader_.Value(feat_reader_.Key());
+}
+
+const std::vector<std::pair<int32, int32> > &
+SequentialFeatureTargetReader::Labels() {
+  KALDI_ASSERT(compact_targets_);
+  if (paired_read_) {
+    KALDI_ASSERT(has_targets_);
+    return sequential_label_reader_.Value();
+  }
+  return random_label_reader_.Value(feat_reader_.Key());
+}
+
+void SequentialFeatureTargetReader::Next() {
+  feat_reader_.Next();
+  if (!paired_read_ || no_targets_)
+    return;
+  // The targets for the previous utterance have been used.
+  if (has_targets_) {
+    if (compact_targets_)
+      sequential_label_reader_.Next();
+    else
+      sequential_target_reader_.Next();
+  }
+  has_targets_ = false;
+  if (!feat_reader_.Done()) {
+    std::string key = feat_reader_.Key();
+    if (!(prev_feat_key_ < key))
+      KALDI_ERR << "Features are not sorted (" << prev_feat_key_ << " before "
+                << key << "), which is required with paired reading.";
+    prev_feat_key_ = key;
+  }
+  SyncTargets();
+}
+
+void SequentialFeatureTargetReader::SyncTargets() {
+  if (compact_targets_)
+    SyncTargets(&sequential_label_reader_);
+  else
+    SyncTargets(&sequential_target_reader_);
+}
+
+template<class Reader>
+void SequentialFeatureTargetReader::SyncTargets(Reader *target_reader) {
+  while (!target_reader->Done()) {
+    std::string target_key = target_reader->Key();
+    if (target_key != prev_target_key_) {
+      if (!prev_target_key_.empty() && !(prev_target_key_ < target_key))
+        KALDI_ERR << "Targets are not sorted (" << prev_target_key_
+                  << " before " << target_key << "), which is required "
+                  << "with paired reading.";
+      prev_target_key_ = target_key;
+    }
+    // Once the features are done, all the remaining targets are extra.
+    if (!feat_reader_.Done()) {
+      const std::string &key = prev_feat_key_;
+      if (!(target_key < key)) {
+        has_targets_ = (target_key == key);
+        return;
+      }
+    }
+    KALDI_WARN << "No features found for targets of utterance "
+               << target_key << ", skipping them.";
+    num_extra_targets_++;
+    target_reader->Next();
+  }
+}
+
+NoiseVectorWriter::NoiseVectorWriter(const std::string &wspecifier,
+                                     const NoiseVectorWriterOptions &opts):
+    opts_(opts) {
+  if (opts_.period < 0)
+    KALDI_ERR << "Invalid --period " << opts_.period;
+  if (opts_.compress && opts_.period == 0)
+    KALDI_ERR << "--compress requires --period > 0.";
+  bool ok;
+  if (opts_.period == 0)
+    ok = vector_writer_.Open(wspecifier);
+  else if (opts_.compress)
+    ok = compressed_matrix_writer_.Open(wspecifier);
+  else
+    ok = matrix_writer_.Open(wspecifier);
+  if (!ok)
+    KALDI_ERR << "Error opening output " << wspecifier;
+}
+
+void NoiseVectorWriter::Write(const std::string &key, int32 num_frames,
+                              const VectorBase<BaseFloat> &noise_vector) const {
+  if (opts_.period == 0) {
+    vector_writer_.Write(key, Vector<BaseFloat>(noise_vector));
+    return;
+  }
+  int32 num_rows = (num_frames + opts_.period - 1) / opts_.period;
+  Matrix<BaseFloat> noise_vectors(num_rows, noise_vector.Dim(), kUndefined);
+  noise_vectors.CopyRowsFromVec(noise_vector);
+  if (opts_.compress)
+    compressed_matrix_writer_.Write(key, CompressedMatrix(noise_vectors));
+  else
+    matrix_writer_.Write(key, noise_vectors);
+}
+
+}  // namespace kaldi
@@ -0,0 +1,252 @@
+// ivector/noise-vector-io.h
+
+// Copyright 2020   Johns Hopkins University (author: Desh Raj)
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef KALDI_IVECTOR_NOISE_VECTOR_IO_H_
+#define KALDI_IVECTOR_NOISE_VECTOR_IO_H_
+
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "matrix/matrix-lib.h"
+#include "util/common-utils.h"
+#include "base/kaldi-error.h"
+
+namespace kaldi {
+
+/// Per-frame labels used for compact targets. The values follow the order
+/// of the columns in the targets written by
+/// steps/segmentation/lats_to_targets.sh.
+enum NoiseFrameLabel {
+  kNoiseFrameSilence = 0,
+  kNoiseFrameSpeech = 1,
+  kNoiseFrameGarbage = 2
+};
+
+/// The speech/non-speech rule for target matrices, used by all the
+/// binaries (offline and online) and by targets-to-labels: a frame is
+/// speech if its speech target is strictly larger than both its silence
+/// and its garbage targets. Ties, e.g. frames whose targets are all zero,
+/// count as non-speech, as they do in NoiseFrameClassifier::Classify().
+inline bool IsSpeechTarget(BaseFloat silence, BaseFloat speech,
+                           BaseFloat garbage) {
+  return speech > silence && speech > garbage;
+}
+
+/// Converts a targets matrix with columns (silence, speech, garbage) to
+/// compact targets, i.e. run-length encoded frame labels stored as
+/// (label, num-frames) pairs; these take a few bytes per segment instead
+/// of 12 bytes per frame. A frame is labeled speech according to
+/// IsSpeechTarget(), and otherwise silence or garbage, whichever is
+/// larger (silence on ties).
+void TargetsToFrameLabels(const MatrixBase<BaseFloat> &targets,
+                          std::vector<std::pair<int32, int32> > *labels);
+
+/// Returns the number of frames covered by compact targets.
+int32 NumFramesInLabels(const std::vector<std::pair<int32, int32> > &labels);
+
+/// Expands compact targets to one decision per frame, true for frames
+/// that are not speech (i.e. silence and garbage).
+void FrameLabelsToSilenceDecisions(
+    const std::vector<std::pair<int32, int32> > &labels,
+    std::vector<bool> *silence_decisions);
+
+/// Works out one decision per frame from a target matrix (columns are
+/// silence, speech and garbage), true for frames that are not speech
+/// according to IsSpeechTarget(). This gives the same decisions as
+/// TargetsToFrameLabels() followed by FrameLabelsToSilenceDecisions().
+void TargetsToSilenceDecisions(const MatrixBase<BaseFloat> &targets,
+                               std::vector<bool> *silence_decisions);
+
+/// Returns the number of target frames that go with "num_frames" feature
+/// frames if the targets are at 1/subsampling_factor of the frame rate
+/// (as with lats_to_targets.sh --frame-subsampling-factor), i.e. one
+/// target frame for every started group of subsampling_factor frames.
+inline int32 NumSubsampledFrames(int32 num_frames, int32 subsampling_factor) {
+  return (num_frames + subsampling_factor - 1) / subsampling_factor;
+}
+
+/// Maps decisions at the target frame rate to "num_frames" feature frames:
+/// frame t gets the decision of target frame t / subsampling_factor. This
+/// is done in place; "silence_decisions" must have
+/// NumSubsampledFrames(num_frames, subsampling_factor) entries on input.
+void SubsampledToFrameDecisions(int32 subsampling_factor, int32 num_frames,
+                                std::vector<bool> *silence_decisions);
+
+/// Checks that there are as many target frames as expected for
+/// "num_frames" feature frames (see NumSubsampledFrames()). If not, warns
+/// about utterance "utt", with "fallback" (e.g. ". Setting all to 0s.")
+/// appended, and returns false. If the targets would match with another
+/// subsampling factor, the warning says so, since this usually means the
+/// --target-subsampling-factor option is wrong.
+bool CheckNumTargetFrames(const std::string &utt, int32 num_frames,
+                          int32 num_target_frames, int32 subsampling_factor,
+                          const std::string &fallback);
+
+/// Outputs to "rows" the first "num_head" and the last "num_tail" rows of
+/// "feats", in that order; rows in both are output once, so if feats has
+/// fewer than num_head + num_tail rows, "rows" is a copy of it.
+void SelectHeadTailRows(const MatrixBase<BaseFloat> &feats,
+                        int32 num_head, int32 num_tail,
+                        Matrix<BaseFloat> *rows);
+
+/// This class reads only the rows SelectHeadTailRows() would select from
+/// matrices in archives, given archive offsets as found in scp files
+/// (e.g. "foo.ark:1234"). It seeks to the rows it needs instead of
+/// reading the matrix, so the cost does not depend on its length; this
+/// works for binary float and double matrices and for all the compressed
+/// formats. The archive last read from is kept open, so consecutive
+/// entries of the same archive (the usual layout of an scp file) are read
+/// through one stream.
+class HeadTailRowReader {
+ public:
+  HeadTailRowReader(int32 num_head, int32 num_tail);
+
+  /// Reads the rows of the matrix at "rxfilename", and outputs the number
+  /// of rows of the whole matrix to "num_rows". Returns false, without
+  /// outputting anything, if "rxfilename" is not an archive offset (e.g.
+  /// a pipe or has a row range), or if the matrix is not in one of these
+  /// formats (e.g. text mode); the caller should then read the whole
+  /// matrix.
+  bool Read(const std::string &rxfilename,
+            Matrix<BaseFloat> *rows, int32 *num_rows);
+
+ private:
+  int32 num_head_;
+  int32 num_tail_;
+  std::string filename_;  // The archive "is_" is open on, if any.
+  std::ifstream is_;
+  KALDI_DISALLOW_COPY_AND_ASSIGN(HeadTailRowReader);
+};
+
+/// This class reads the features and the speech/silence targets that the
+/// noise vector binaries need. It iterates over the features; the targets
+/// for the current utterance are available through HasTargets() and
+/// Targets(). By default the targets are read with a random-access
+/// reader. With "paired_read" set, the two tables are instead walked in
+/// lockstep, so each target matrix is read once, in order, and only the
+/// current one is kept in memory; both tables must then be sorted on the
+/// key (as for the "s" option in rspecifiers). Targets with no matching
+/// features are skipped with a warning and counted in NumExtraTargets().
+/// With "compact_targets" set, the targets table holds compact targets (see
+/// TargetsToFrameLabels()), which are accessed with Labels() instead of
+/// Targets(). If "target_rspecifier" is empty, no targets are read and
+/// HasTargets() is always false.
+class SequentialFeatureTargetReader {
+ public:
+  SequentialFeatureTargetReader(const std::string &feat_rspecifier,
+                                const std::string &target_rspecifier,
+                                bool paired_read,
+                                bool compact_targets = false);
+
+  bool Done() { return feat_reader_.Done(); }
+
+  std::string Key() { return feat_reader_.Key(); }
+
+  const Matrix<BaseFloat> &Feats() { return feat_reader_.Value(); }
+
+  /// Returns true if there are targets for the current utterance.
+  bool HasTargets();
+
+  /// Returns the targets for the current utterance; requires HasTargets()
+  /// and that the targets are not compact.
+  const Matrix<BaseFloat> &Targets();
+
+  /// Returns the compact targets for the current utterance; requires
+  /// HasTargets() and that the targets are compact.
+  const std::vector<std::pair<int32, int32> > &Labels();
+
+  bool CompactTargets() const { return compact_targets_; }
+
+  void Next();
+
+  /// The number of targets that had no matching features (only counted
+  /// with "paired_read").
+  int32 NumExtraTargets() const { return num_extra_targets_; }
+
+ private:
+  // Advances the sequential target reader to the first key that is not
+  // less than the current feature key.
+  void SyncTargets();
+
+  template<class Reader>
+  void SyncTargets(Reader *target_reader);
+
+  bool paired_read_;
+  bool compact_targets_;
+  SequentialBaseFloatMatrixReader feat_reader_;
+  RandomAccessBaseFloatMatrixReader random_target_reader_;
+  SequentialBaseFloatMatrixReader sequential_target_reader_;
+  RandomAccessInt32PairVectorReader random_label_reader_;
+  SequentialInt32PairVectorReader sequential_label_reader_;
+  // True if no targets table was given.
+  bool no_targets_;
+  // Whether the sequential target reader is at the current utterance.
+  bool has_targets_;
+  // The previous keys seen in each table, to check they are sorted.
+  std::string prev_feat_key_;
+  std::string prev_target_key_;
+  int32 num_extra_targets_;
+};
+
+/// Options for NoiseVectorWriter.
+struct NoiseVectorWriterOptions {
+  int32 period;
+  bool compress;
+
+  NoiseVectorWriterOptions(): period(0), compress(false) { }
+
+  void Register(OptionsItf *opts) {
+    opts->Register("period", &period, "If > 0, write a matrix per "
+                   "utterance with the noise vector repeated on one row per "
+                   "<period> frames, as read by nnet3 as online i-vectors "
+                   "(i.e. --online-ivector-period); otherwise write a "
+                   "vector.");
+    opts->Register("compress", &compress, "If true (and --period > 0), "
+                   "write the matrices in compressed form.");
+  }
+};
+
+/// Writes one noise vector per utterance, either as a vector or, if
+/// opts.period > 0, directly as the per-period matrix that nnet3 uses as
+/// online i-vectors: ceil(num_frames / period) copies of the vector, which
+/// is what expanding the vector to every frame and keeping every
+/// period'th frame (subsample-feats) gives.
+class NoiseVectorWriter {
+ public:
+  NoiseVectorWriter(const std::string &wspecifier,
+                    const NoiseVectorWriterOptions &opts);
+
+  /// "num_frames" is the number of frames in the utterance; it only
+  /// matters if writing matrices.
+  void Write(const std::string &key, int32 num_frames,
+             const VectorBase<BaseFloat> &noise_vector) const;
+
+ private:
+  NoiseVectorWriterOptions opts_;
+  BaseFloatVectorWriter vector_writer_;
+  BaseFloatMatrixWriter matrix_writer_;
+  CompressedMatrixWriter compressed_matrix_writer_;
+};
+
+}  // namespace kaldi
+
+#endif  // KALDI_IVECTOR_NOISE_VECTOR_IO_H_
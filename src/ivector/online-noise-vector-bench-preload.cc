@@ -0,0 +1,170 @@
+// ivector/online-noise-vector-bench-preload.cc
+
+// Copyright 2020   Johns Hopkins University (author: Desh Raj)
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+// Allocation counter for online-noise-vector-bench. This is built as a
+// separate shared library and only takes effect when it is preloaded with
+// LD_PRELOAD (see the README). It forwards every allocation function to the next
+// definition (normally the C library's, found with dlsym(RTLD_NEXT)) and
+// counts the calls; the bench looks up KaldiBenchNumAllocs() at run time
+// and reports the counts as -1 if it is not there. free() is forwarded
+// unchanged, so memory always goes back to the allocator it came from.
+//
+// This file deliberately does not include <cstdlib>, whose declarations
+// of these functions may carry exception specifications.
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+
+#include <atomic>
+
+namespace {
+
+typedef void *(*MallocFn)(size_t);
+typedef void *(*CallocFn)(size_t, size_t);
+typedef void *(*ReallocFn)(void*, size_t);
+typedef void (*FreeFn)(void*);
+typedef int (*PosixMemalignFn)(void**, size_t, size_t);
+typedef void *(*MemalignFn)(size_t, size_t);
+
+MallocFn next_malloc = NULL;
+CallocFn next_calloc = NULL;
+ReallocFn next_realloc = NULL;
+FreeFn next_free = NULL;
+PosixMemalignFn next_posix_memalign = NULL;
+MemalignFn next_memalign = NULL;
+MemalignFn next_aligned_alloc = NULL;
+
+std::atomic<size_t> num_allocs(0);
+
+// dlsym() may itself allocate (glibc calls calloc()) before the next
+// definitions are known; such requests are served from this buffer and
+// never freed.
+const size_t kBootstrapSize = 16384;
+alignas(64) char bootstrap_buffer[kBootstrapSize];
+size_t bootstrap_used = 0;
+bool resolving = false;
+
+bool InBootstrapBuffer(const void *ptr) {
+  const char *p = static_cast<const char*>(ptr);
+  return p >= bootstrap_buffer && p < bootstrap_buffer + kBootstrapSize;
+}
+
+void *BootstrapAlloc(size_t size) {
+  size = (size + 63) & ~static_cast<size_t>(63);
+  if (size > kBootstrapSize - bootstrap_used)
+    return NULL;
+  void *ans = bootstrap_buffer + bootstrap_used;
+  bootstrap_used += size;
+  return ans;  // Zero-initialized, as a static array.
+}
+
+void Resolve() {
+  if (next_free != NULL || resolving)
+    return;
+  resolving = true;
+  next_malloc = reinterpret_cast<MallocFn>(dlsym(RTLD_NEXT, "malloc"));
+  next_calloc = reinterpret_cast<CallocFn>(dlsym(RTLD_NEXT, "calloc"));
+  next_realloc = reinterpret_cast<ReallocFn>(dlsym(RTLD_NEXT, "realloc"));
+  next_posix_memalign = reinterpret_cast<PosixMemalignFn>(
+      dlsym(RTLD_NEXT, "posix_memalign"));
+  next_memalign = reinterpret_cast<MemalignFn>(dlsym(RTLD_NEXT, "memalign"));
+  next_aligned_alloc = reinterpret_cast<MemalignFn>(
+      dlsym(RTLD_NEXT, "aligned_alloc"));
+  // Set last: it is what Resolve() checks for.
+  next_free = reinterpret_cast<FreeFn>(dlsym(RTLD_NEXT, "free"));
+  resolving = false;
+}
+
+}  // namespace
+
+extern "C" {
+
+size_t KaldiBenchNumAllocs() {
+  return num_allocs.load(std::memory_order_relaxed);
+}
+
+void *malloc(size_t size) {
+  Resolve();
+  if (next_malloc == NULL)
+    return BootstrapAlloc(size);
+  num_allocs.fetch_add(1, std::memory_order_relaxed);
+  return next_malloc(size);
+}
+
+void *calloc(size_t num, size_t size) {
+  Resolve();
+  if (next_calloc == NULL)
+    return BootstrapAlloc(num * size);
+  num_allocs.fetch_add(1, std::memory_order_relaxed);
+  return next_calloc(num, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+  Resolve();
+  if (ptr != NULL && InBootstrapBuffer(ptr)) {
+    // We do not know the old size; copy what may have belonged to it.
+    void *ans = malloc(size);
+    if (ans != NULL) {
+      size_t available = bootstrap_buffer + kBootstrapSize -
+          static_cast<char*>(ptr);
+      memcpy(ans, ptr, size < available ? size : available);
+    }
+    return ans;
+  }
+  if (next_realloc == NULL)
+    return NULL;
+  num_allocs.fetch_add(1, std::memory_order_relaxed);
+  return next_realloc(ptr, size);
+}
+
+void free(void *ptr) {
+  if (ptr == NULL || InBootstrapBuffer(ptr))
+    return;
+  Resolve();
+  if (next_free != NULL)  // Else we are inside Resolve(); leak it.
+    next_free(ptr);
+}
+
+int posix_memalign(void **ptr, size_t alignment, size_t size) {
+  Resolve();
+  if (next_posix_memalign == NULL)
+    return ENOMEM;
+  num_allocs.fetch_add(1, std::memory_order_relaxed);
+  return next_posix_memalign(ptr, alignment, size);
+}
+
+void *memalign(size_t alignment, size_t size) {
+  Resolve();
+  if (next_memalign == NULL)
+    return NULL;
+  num_allocs.fetch_add(1, std::memory_order_relaxed);
+  return next_memalign(alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+  Resolve();
+  if (next_aligned_alloc == NULL)
+    return NULL;
+  num_allocs.fetch_add(1, std::memory_order_relaxed);
+  return next_aligned_alloc(alignment, size);
+}
+
+}  // extern "C"
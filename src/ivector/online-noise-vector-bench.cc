@@ -0,0 +1,360 @@
+// ivector/online-noise-vector-bench.cc
+
+// Copyright 2020   Johns Hopkins University (author: Desh Raj)
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <dlfcn.h>
+#include <sys/resource.h>
+#include <cstdlib>
+#include <iostream>
+
+#include "base/kaldi-common.h"
+#include "base/timer.h"
+#include "util/common-utils.h"
+#include "ivector/online-noise-vector.h"
+
+namespace kaldi {
+
+// Returns the peak resident set size of the process so far, in kB.
+static long PeakRssKb() {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    return -1;
+  return usage.ru_maxrss;
+}
+
+// Counting of heap allocations. This needs the allocation counter of
+// online-noise-vector-bench-preload.cc to be preloaded (see the README);
+// otherwise the allocation counts are reported as -1.
+typedef size_t (*NumAllocsFn)();
+static NumAllocsFn num_allocs_fn = NULL;
+
+static size_t NumAllocs() {
+  return (num_allocs_fn != NULL ? num_allocs_fn() : 0);
+}
+
+static double AllocsPer(size_t num_allocs_done, double count) {
+  return (num_allocs_fn != NULL ? num_allocs_done / count : -1.0);
+}
+
+// Makes a random positive definite matrix of dimension "dim".
+static void RandPosDefSpMatrix(int32 dim, SpMatrix<BaseFloat> *sp) {
+  Matrix<BaseFloat> A(dim, dim);
+  A.SetRandn();
+  sp->Resize(dim);
+  sp->AddMat2(1.0 / dim, A, kNoTrans, 0.0);
+  sp->AddToDiag(1.0);
+}
+
+// Makes a prior for features of dimension "feat_dim" from a random mean
+// and covariance of the (2 * feat_dim)-dimensional noise vectors, and
+// returns the time EstimatePriorParameters() took, in seconds.
+static double MakeSyntheticPrior(int32 feat_dim, OnlineNoisePrior *prior) {
+  Vector<BaseFloat> mean(2 * feat_dim);
+  mean.SetRandn();
+  SpMatrix<BaseFloat> covariance;
+  RandPosDefSpMatrix(2 * feat_dim, &covariance);
+  Timer timer;
+  prior->EstimatePriorParameters(mean, covariance, 2 * feat_dim, 1.0);
+  return timer.Elapsed();
+}
+
+// Makes random features, offset by "offset", and speech/silence decisions
+// with a fraction "speech_ratio" of speech frames.
+static void MakeSyntheticData(int32 num_frames, int32 feat_dim,
+                              BaseFloat speech_ratio, BaseFloat offset,
+                              Matrix<BaseFloat> *feats,
+                              std::vector<bool> *silence_decisions) {
+  feats->Resize(num_frames, feat_dim);
+  feats->SetRandn();
+  feats->Add(offset);
+  silence_decisions->resize(num_frames);
+  for (int32 i = 0; i < num_frames; i++)
+    (*silence_decisions)[i] = (RandUniform() >= speech_ratio);
+}
+
+// Times ExtractVectors() for one configuration; "prior" is NULL for MLE
+// estimation.
+static void BenchExtractVectors(const OnlineNoisePrior *prior,
+                                int32 feat_dim, int32 period,
+                                int32 num_frames, BaseFloat speech_ratio,
+                                BaseFloat offset, int32 num_repeats) {
+  Matrix<BaseFloat> feats, noise_vectors;
+  std::vector<bool> silence_decisions;
+  MakeSyntheticData(num_frames, feat_dim, speech_ratio, offset,
+                    &feats, &silence_decisions);
+  OnlineNoiseVector *noise_vec = (prior != NULL ?
+      new OnlineNoiseVector(*prior, period) :
+      new OnlineNoiseVector(feat_dim, period));
+  // Warm up, so that the output and the history are allocated.
+  noise_vec->ExtractVectors(feats, silence_decisions, &noise_vectors);
+
+  size_t allocs_before = NumAllocs();
+  Timer timer;
+  for (int32 n = 0; n < num_repeats; n++)
+    noise_vec->ExtractVectors(feats, silence_decisions, &noise_vectors);
+  double elapsed = timer.Elapsed();
+  size_t allocs_done = NumAllocs() - allocs_before;
+  delete noise_vec;
+
+  double total_frames = static_cast<double>(num_repeats) * num_frames,
+      total_chunks = static_cast<double>(num_repeats) *
+      ((num_frames + period - 1) / period);
+  std::cout << "bench=extract-vectors mode=" << (prior != NULL ? "map" : "mle")
+            << " dim=" << feat_dim << " period=" << period
+            << " frames=" << num_frames << " speech-ratio=" << speech_ratio
+            << " ns-per-frame=" << 1.0e+09 * elapsed / total_frames
+            << " ns-per-chunk=" << 1.0e+09 * elapsed / total_chunks
+            << " allocs-per-frame=" << AllocsPer(allocs_done, total_frames)
+            << " peak-rss-kb=" << PeakRssKb() << std::endl;
+}
+
+// Times OnlineNoiseVector::ExtractVectorsBatch() on "batch_size"
+// utterances against ExtractVectors() on each in turn, and checks that the
+// results agree.
+static void BenchExtractVectorsBatch(const OnlineNoisePrior &prior,
+                                     int32 feat_dim, int32 period,
+                                     int32 num_frames, int32 batch_size,
+                                     BaseFloat offset, int32 num_repeats) {
+  std::vector<Matrix<BaseFloat> > feats(batch_size);
+  std::vector<std::vector<bool> > silence_decisions(batch_size);
+  std::vector<OnlineNoiseVector*> batch_extractors, extractors;
+  std::vector<const MatrixBase<BaseFloat>*> feats_ptrs;
+  std::vector<const std::vector<bool>*> decisions_ptrs;
+  for (int32 n = 0; n < batch_size; n++) {
+    MakeSyntheticData(num_frames, feat_dim, 0.5, offset, &(feats[n]),
+                      &(silence_decisions[n]));
+    feats_ptrs.push_back(&(feats[n]));
+    decisions_ptrs.push_back(&(silence_decisions[n]));
+    batch_extractors.push_back(new OnlineNoiseVector(prior, period));
+    extractors.push_back(new OnlineNoiseVector(prior, period));
+  }
+  std::vector<Matrix<BaseFloat> > batch_vectors, vectors(batch_size);
+  // The first call, from the prior, also checks the results.
+  OnlineNoiseVector::ExtractVectorsBatch(batch_extractors, feats_ptrs,
+                                         decisions_ptrs, &batch_vectors);
+  BaseFloat max_diff = 0.0;
+  for (int32 n = 0; n < batch_size; n++) {
+    extractors[n]->ExtractVectors(feats[n], silence_decisions[n],
+                                  &(vectors[n]));
+    vectors[n].AddMat(-1.0, batch_vectors[n]);
+    max_diff = std::max(max_diff, vectors[n].LargestAbsElem());
+  }
+
+  Timer timer;
+  for (int32 r = 0; r < num_repeats; r++)
+    for (int32 n = 0; n < batch_size; n++)
+      extractors[n]->ExtractVectors(feats[n], silence_decisions[n],
+                                    &(vectors[n]));
+  double elapsed = timer.Elapsed();
+  timer.Reset();
+  for (int32 r = 0; r < num_repeats; r++)
+    OnlineNoiseVector::ExtractVectorsBatch(batch_extractors, feats_ptrs,
+                                           decisions_ptrs, &batch_vectors);
+  double batch_elapsed = timer.Elapsed();
+  for (int32 n = 0; n < batch_size; n++) {
+    delete batch_extractors[n];
+    delete extractors[n];
+  }
+
+  double total_frames = static_cast<double>(num_repeats) * num_frames *
+      batch_size;
+  std::cout << "bench=extract-vectors-batch dim=" << feat_dim
+            << " period=" << period << " frames=" << num_frames
+            << " batch-size=" << batch_size
+            << " ns-per-frame=" << 1.0e+09 * batch_elapsed / total_frames
+            << " ns-per-frame-unbatched="
+            << 1.0e+09 * elapsed / total_frames
+            << " max-diff=" << max_diff << std::endl;
+}
+
+// Times OnlineNoisePrior::SolvePosteriorMean(), which is the main cost
+// of OnlineNoiseVector::UpdateVector().
+static void BenchSolve(const OnlineNoisePrior &prior, int32 feat_dim,
+                       int32 num_repeats) {
+  Vector<double> speech_term(feat_dim), noise_term(feat_dim),
+      x(2 * feat_dim);
+  speech_term.SetRandn();
+  noise_term.SetRandn();
+  size_t allocs_before = NumAllocs();
+  Timer timer;
+  for (int32 n = 0; n < num_repeats; n++)
+    prior.SolvePosteriorMean(1.0 + n, 1.0 + 0.5 * n, speech_term,
+                             noise_term, &x);
+  double elapsed = timer.Elapsed();
+  std::cout << "bench=solve dim=" << feat_dim
+            << " ns-per-call=" << 1.0e+09 * elapsed / num_repeats
+            << " allocs-per-call="
+            << AllocsPer(NumAllocs() - allocs_before, num_repeats)
+            << std::endl;
+}
+
+// Accumulates the scatter of a long stream of frames both with float
+// accumulators (one SymAddMat2() per chunk, as OnlineNoiseVector used to
+// do) and with the double accumulators of AccumulateSpeechNoiseStats(),
+// and compares the resulting Tr(Lambda S), which is what
+// UpdateScalingParams() uses, against a per-chunk double reference.
+static void BenchLongStream(int32 feat_dim, int32 period, int32 num_frames,
+                            BaseFloat offset) {
+  Matrix<BaseFloat> chunk;
+  std::vector<bool> silence_decisions;
+  SpMatrix<BaseFloat> Lambda_sp;
+  RandPosDefSpMatrix(feat_dim, &Lambda_sp);
+  Matrix<BaseFloat> Lambda(Lambda_sp);
+  Matrix<double> Lambda_double(Lambda);
+
+  Matrix<BaseFloat> float_scatter(feat_dim, feat_dim);
+  Matrix<double> double_scatter(feat_dim, feat_dim),
+      ref_scatter(feat_dim, feat_dim), chunk_double;
+  Vector<double> speech_sum(feat_dim), noise_sum(feat_dim);
+  int32 num_speech = 0, num_noise = 0;
+  double float_time = 0.0, double_time = 0.0;
+  for (int32 done = 0; done < num_frames; done += period) {
+    int32 this_num_frames = std::min(period, num_frames - done);
+    MakeSyntheticData(this_num_frames, feat_dim, 1.0, offset,
+                      &chunk, &silence_decisions);
+    Timer timer;
+    float_scatter.SymAddMat2(1.0, chunk, kTrans, 1.0);
+    float_time += timer.Elapsed();
+    timer.Reset();
+    AccumulateSpeechNoiseStats(chunk, silence_decisions, 0,
+                               &speech_sum, &noise_sum,
+                               &double_scatter, NULL,
+                               &num_speech, &num_noise);
+    double_time += timer.Elapsed();
+    // The reference adds the exact (double) scatter of each chunk.
+    chunk_double.Resize(this_num_frames, feat_dim);
+    chunk_double.CopyFromMat(chunk);
+    ref_scatter.SymAddMat2(1.0, chunk_double, kTrans, 1.0);
+  }
+  float_scatter.CopyLowerToUpper();
+  ref_scatter.CopyLowerToUpper();
+  double ref = TraceMatMat(Lambda_double, ref_scatter),
+      float_err = std::abs(TraceMatMat(Lambda, float_scatter) - ref) / ref,
+      double_err = std::abs(TraceMatMat(Lambda_double, double_scatter) -
+                            ref) / ref;
+  std::cout << "bench=long-stream dim=" << feat_dim << " period=" << period
+            << " frames=" << num_frames << " offset=" << offset
+            << " float-rel-error=" << float_err
+            << " double-rel-error=" << double_err
+            << " float-ns-per-frame=" << 1.0e+09 * float_time / num_frames
+            << " double-ns-per-frame=" << 1.0e+09 * double_time / num_frames
+            << std::endl;
+}
+
+}  // namespace kaldi
+
+int main(int argc, char *argv[]) {
+  try {
+    using namespace kaldi;
+    using kaldi::int32;
+
+    const char *usage =
+        "Micro-benchmark for the online noise vector library, on synthetic\n"
+        "features and priors. For each combination of feature dimension,\n"
+        "period, utterance length and speech ratio it times\n"
+        "OnlineNoiseVector::ExtractVectors() (MAP and MLE), and it also\n"
+        "times OnlineNoisePrior::EstimatePriorParameters() and the posterior\n"
+        "solve for each dimension, and ExtractVectorsBatch() for each\n"
+        "batch size. It prints one line per measurement, with\n"
+        "ns/frame, heap allocations/frame and the peak RSS so far (the\n"
+        "allocations are -1 unless online-noise-vector-bench-preload.so\n"
+        "is preloaded). With --long-stream-frames > 0 it also compares\n"
+        "the float and double accumulation of the scatter statistics on a\n"
+        "long stream.\n"
+        "Usage: online-noise-vector-bench [options]\n"
+        "E.g.: online-noise-vector-bench --dims=40 --periods=1,10,100\n";
+
+    ParseOptions po(usage);
+    std::string dims_str = "20,40,80", periods_str = "1,10,100",
+        lengths_str = "500,5000", speech_ratios_str = "0.2,0.5,0.8",
+        batch_sizes_str = "1,8,32";
+    int32 num_repeats = 10, long_stream_frames = 1000000, srand_seed = 0;
+    BaseFloat offset = 10.0;
+    po.Register("dims", &dims_str, "Comma-separated list of feature "
+                "dimensions.");
+    po.Register("periods", &periods_str, "Comma-separated list of periods.");
+    po.Register("lengths", &lengths_str, "Comma-separated list of utterance "
+                "lengths, in frames.");
+    po.Register("speech-ratios", &speech_ratios_str, "Comma-separated list "
+                "of fractions of speech frames.");
+    po.Register("batch-sizes", &batch_sizes_str, "Comma-separated list of "
+                "batch sizes for ExtractVectorsBatch() (empty to skip).");
+    po.Register("num-repeats", &num_repeats, "Number of times each "
+                "measurement is repeated.");
+    po.Register("long-stream-frames", &long_stream_frames, "Number of "
+                "frames for the float vs. double accumulation comparison "
+                "(0 to skip it).");
+    po.Register("offset", &offset, "Offset added to the synthetic features "
+                "(large offsets, as in log-energies, make float "
+                "accumulation lose precision sooner).");
+    po.Register("srand", &srand_seed, "Seed for the random number "
+                "generator.");
+    po.Read(argc, argv);
+
+    if (po.NumArgs() != 0) {
+      po.PrintUsage();
+      exit(1);
+    }
+    srand(srand_seed);
+    num_allocs_fn = reinterpret_cast<NumAllocsFn>(
+        dlsym(RTLD_DEFAULT, "KaldiBenchNumAllocs"));
+
+    std::vector<int32> dims, periods, lengths, batch_sizes;
+    std::vector<BaseFloat> speech_ratios;
+    if (!SplitStringToIntegers(dims_str, ",", true, &dims) ||
+        !SplitStringToIntegers(periods_str, ",", true, &periods) ||
+        !SplitStringToIntegers(lengths_str, ",", true, &lengths) ||
+        !SplitStringToIntegers(batch_sizes_str, ",", true, &batch_sizes) ||
+        !SplitStringToFloats(speech_ratios_str, ",", true, &speech_ratios))
+      KALDI_ERR << "Invalid list option.";
+    if (num_repeats <= 0)
+      KALDI_ERR << "Invalid --num-repeats " << num_repeats;
+    for (size_t b = 0; b < batch_sizes.size(); b++)
+      if (batch_sizes[b] <= 0)
+        KALDI_ERR << "Invalid --batch-sizes " << batch_sizes_str;
+
+    for (size_t d = 0; d < dims.size(); d++) {
+      int32 dim = dims[d];
+      OnlineNoisePrior prior;
+      double estimate_time = MakeSyntheticPrior(dim, &prior);
+      std::cout << "bench=estimate-prior dim=" << dim
+                << " ms-per-call=" << 1000.0 * estimate_time << std::endl;
+      BenchSolve(prior, dim, 100 * num_repeats);
+      for (size_t p = 0; p < periods.size(); p++)
+        for (size_t l = 0; l < lengths.size(); l++)
+          for (size_t r = 0; r < speech_ratios.size(); r++) {
+            BenchExtractVectors(&prior, dim, periods[p], lengths[l],
+                                speech_ratios[r], offset, num_repeats);
+            BenchExtractVectors(NULL, dim, periods[p], lengths[l],
+                                speech_ratios[r], offset, num_repeats);
+          }
+      for (size_t p = 0; p < periods.size(); p++)
+        for (size_t l = 0; l < lengths.size(); l++)
+          for (size_t b = 0; b < batch_sizes.size(); b++)
+            BenchExtractVectorsBatch(prior, dim, periods[p], lengths[l],
+                                     batch_sizes[b], offset, num_repeats);
+      if (long_stream_frames > 0)
+        for (size_t p = 0; p < periods.size(); p++)
+          BenchLongStream(dim, periods[p], long_stream_frames, offset);
+    }
+    return 0;
+  } catch(const std::exception &e) {
+    std::cerr << e.what();
+    return -1;
+  }
+}
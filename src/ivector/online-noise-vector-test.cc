@@ -0,0 +1,354 @@
+// ivector/online-noise-vector-test.cc
+
+// Copyright 2020   Johns Hopkins University (author: Desh Raj)
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <sstream>
+
+#include "base/kaldi-common.h"
+#include "util/common-utils.h"
+#include "ivector/online-noise-vector.h"
+
+namespace kaldi {
+
+// The relative error allowed between the noise vectors and the
+// brute-force reference (see OnlineNoisePriorFactors::SolvePosteriorMean()).
+static const double kSolveTolerance = 1.0e-05;
+
+// Makes a prior for features of dimension "feat_dim" from a random mean
+// and a random positive definite covariance of the noise vectors.
+static void InitRandPrior(int32 feat_dim, OnlineNoisePrior *prior) {
+  int32 dim = 2 * feat_dim;
+  Vector<BaseFloat> mean(dim);
+  mean.SetRandn();
+  Matrix<BaseFloat> A(dim, dim);
+  A.SetRandn();
+  SpMatrix<BaseFloat> covariance(dim);
+  covariance.AddMat2(1.0 / dim, A, kNoTrans, 0.0);
+  covariance.AddToDiag(1.0);
+  prior->EstimatePriorParameters(mean, covariance, dim, 0.5 + RandUniform());
+}
+
+// Makes random features and speech/silence decisions; every utterance
+// gets a few frames of each class.
+static void InitRandData(int32 num_frames, int32 feat_dim,
+                         Matrix<BaseFloat> *feats,
+                         std::vector<bool> *silence_decisions) {
+  feats->Resize(num_frames, feat_dim);
+  feats->SetRandn();
+  feats->Add(RandGauss());
+  silence_decisions->resize(num_frames);
+  for (int32 i = 0; i < num_frames; i++)
+    (*silence_decisions)[i] = (i < 2 ? i == 0 : RandUniform() < 0.4);
+}
+
+// Computes the posterior mean x = K^{-1} Q by building K and Q explicitly
+// from the prior parameters and inverting K, all in double precision
+// (see the comment in OnlineNoiseVector::ComputeVector() for K and Q).
+static void ReferencePosteriorMean(const OnlineNoisePriorFactors &prior,
+                                   double r_s, double r_n,
+                                   double num_speech, double num_noise,
+                                   const VectorBase<double> &speech_sum,
+                                   const VectorBase<double> &noise_sum,
+                                   Vector<double> *x) {
+  int32 dim = prior.FeatDim();
+  Matrix<double> K(2 * dim, 2 * dim);
+  SubMatrix<double> K_ss(K, 0, dim, 0, dim), K_sn(K, 0, dim, dim, dim),
+      K_ns(K, dim, dim, 0, dim), K_nn(K, dim, dim, dim, dim);
+  K_ss.AddMat(1.0 + r_s * num_speech, prior.LambdaS());
+  K_sn.AddMatMat(-1.0, prior.LambdaS(), kNoTrans, prior.B(), kNoTrans, 0.0);
+  K_ns.AddMatMat(-1.0, prior.B(), kTrans, prior.LambdaS(), kNoTrans, 0.0);
+  K_nn.AddMat(1.0 + r_n * num_noise, prior.LambdaN());
+  K_nn.AddMatMatMat(1.0, prior.B(), kTrans, prior.LambdaS(), kNoTrans,
+                    prior.B(), kNoTrans, 1.0);
+
+  Vector<double> Q(2 * dim), temp(dim);
+  SubVector<double> Q_s(Q, 0, dim), Q_n(Q, dim, dim);
+  temp.CopyFromVec(prior.A());
+  temp.AddVec(r_s, speech_sum);
+  Q_s.AddMatVec(1.0, prior.LambdaS(), kNoTrans, temp, 0.0);
+  temp.CopyFromVec(prior.MuN());
+  temp.AddVec(r_n, noise_sum);
+  Q_n.AddMatVec(1.0, prior.LambdaN(), kNoTrans, temp, 0.0);
+  Vector<double> lambda_s_a(dim);
+  lambda_s_a.AddMatVec(1.0, prior.LambdaS(), kNoTrans, prior.A(), 0.0);
+  Q_n.AddMatVec(1.0, prior.B(), kTrans, lambda_s_a, 1.0);
+
+  K.Invert();
+  x->Resize(2 * dim);
+  x->AddMatVec(1.0, K, kNoTrans, Q, 0.0);
+}
+
+// Computes the noise vectors that OnlineNoiseVector::ExtractVectors()
+// should output for one utterance, from scratch: at each chunk boundary
+// the posterior mean is computed from all the frames so far, and then the
+// scaling factors are re-estimated from all of them. If "prior" is empty,
+// these are the MLE estimates, i.e. the means of the frames of each class.
+static void ReferenceVectors(const OnlineNoisePriorFactors &prior,
+                             int32 period,
+                             const MatrixBase<BaseFloat> &feats,
+                             const std::vector<bool> &silence_decisions,
+                             Matrix<double> *noise_vectors) {
+  int32 num_frames = feats.NumRows(), dim = feats.NumCols(),
+      num_chunks = (num_frames + period - 1) / period;
+  bool mle = (prior.FeatDim() == 0);
+  double r_s = prior.ScaleSpeech(), r_n = prior.ScaleNoise(),
+      num_speech = 0.0, num_noise = 0.0;
+  Vector<double> speech_sum(dim), noise_sum(dim);
+  Matrix<double> speech_scatter(dim, dim), noise_scatter(dim, dim);
+  noise_vectors->Resize(num_chunks, 2 * dim);
+  for (int32 c = 0; c < num_chunks; c++) {
+    int32 end = std::min(num_frames, (c + 1) * period);
+    for (int32 t = c * period; t < end; t++) {
+      Vector<double> frame(feats.Row(t));
+      if (silence_decisions[t]) {
+        num_noise += 1.0;
+        noise_sum.AddVec(1.0, frame);
+        noise_scatter.AddVecVec(1.0, frame, frame);
+      } else {
+        num_speech += 1.0;
+        speech_sum.AddVec(1.0, frame);
+        speech_scatter.AddVecVec(1.0, frame, frame);
+      }
+    }
+    SubVector<double> noise_vector(*noise_vectors, c);
+    if (mle) {
+      if (num_speech > 0.0)
+        noise_vector.Range(0, dim).AddVec(1.0 / num_speech, speech_sum);
+      if (num_noise > 0.0)
+        noise_vector.Range(dim, dim).AddVec(1.0 / num_noise, noise_sum);
+      continue;
+    }
+    Vector<double> x;
+    ReferencePosteriorMean(prior, r_s, r_n, num_speech, num_noise,
+                           speech_sum, noise_sum, &x);
+    noise_vector.CopyFromVec(x);
+    if (num_speech > 0.0)
+      r_s = dim * num_speech / TraceMatMat(prior.LambdaS(), speech_scatter);
+    if (num_noise > 0.0)
+      r_n = dim * num_noise / TraceMatMat(prior.LambdaN(), noise_scatter);
+  }
+}
+
+// Checks that each row of "noise_vectors" is within kSolveTolerance
+// (relative) of the corresponding row of "reference".
+static void AssertVectorsMatch(const MatrixBase<BaseFloat> &noise_vectors,
+                               const MatrixBase<double> &reference) {
+  KALDI_ASSERT(noise_vectors.NumRows() == reference.NumRows() &&
+               noise_vectors.NumCols() == reference.NumCols());
+  for (int32 c = 0; c < reference.NumRows(); c++) {
+    Vector<double> diff(noise_vectors.Row(c));
+    diff.AddVec(-1.0, reference.Row(c));
+    double error = diff.Norm(2.0), norm = reference.Row(c).Norm(2.0);
+    if (error > kSolveTolerance * std::max(norm, 1.0))
+      KALDI_ERR << "Noise vector " << c << " differs from the reference: "
+                << "error " << error << ", norm " << norm;
+  }
+}
+
+void UnitTestExtractVectors() {
+  int32 feat_dim = RandInt(2, 20), period = RandInt(1, 15),
+      num_frames = RandInt(1, 200);
+  OnlineNoisePrior prior;
+  InitRandPrior(feat_dim, &prior);
+  Matrix<BaseFloat> feats, noise_vectors;
+  std::vector<bool> silence_decisions;
+  InitRandData(num_frames, feat_dim, &feats, &silence_decisions);
+  Matrix<double> reference;
+
+  OnlineNoiseVector noise_vec(prior, period);
+  noise_vec.ExtractVectors(feats, silence_decisions, &noise_vectors);
+  ReferenceVectors(prior.Factors(), period, feats, silence_decisions,
+                   &reference);
+  AssertVectorsMatch(noise_vectors, reference);
+
+  // The batched extraction should give the same vectors.
+  Matrix<BaseFloat> feats2;
+  std::vector<bool> silence_decisions2;
+  InitRandData(RandInt(1, 200), feat_dim, &feats2, &silence_decisions2);
+  std::vector<OnlineNoiseVector*> extractors;
+  std::vector<const MatrixBase<BaseFloat>*> feats_batch;
+  std::vector<const std::vector<bool>*> decisions_batch;
+  OnlineNoiseVector batch_vec(prior, period), batch_vec2(prior, period);
+  extractors.push_back(&batch_vec);
+  extractors.push_back(&batch_vec2);
+  feats_batch.push_back(&feats);
+  feats_batch.push_back(&feats2);
+  decisions_batch.push_back(&silence_decisions);
+  decisions_batch.push_back(&silence_decisions2);
+  std::vector<Matrix<BaseFloat> > batch_vectors;
+  OnlineNoiseVector::ExtractVectorsBatch(extractors, feats_batch,
+                                         decisions_batch, &batch_vectors);
+  AssertVectorsMatch(batch_vectors[0], reference);
+  ReferenceVectors(prior.Factors(), period, feats2, silence_decisions2,
+                   &reference);
+  AssertVectorsMatch(batch_vectors[1], reference);
+
+  // MLE estimates.
+  OnlineNoiseVector mle_vec(feat_dim, period);
+  mle_vec.ExtractVectors(feats, silence_decisions, &noise_vectors);
+  ReferenceVectors(OnlineNoisePriorFactors(), period, feats,
+                   silence_decisions, &reference);
+  AssertVectorsMatch(noise_vectors, reference);
+}
+
+// Streams two utterances through one extractor in pieces of random
+// length, and checks that the vectors are the same as from calling
+// ExtractVectors() on each utterance in turn, so that the statistics
+// carry over from the first utterance to the second one in both cases.
+void UnitTestStreaming() {
+  int32 feat_dim = RandInt(2, 20), period = RandInt(1, 15);
+  OnlineNoisePrior prior;
+  InitRandPrior(feat_dim, &prior);
+  OnlineNoiseVector stream_vec(prior, period), noise_vec(prior, period);
+  for (int32 utt = 0; utt < 2; utt++) {
+    int32 num_frames = RandInt(1, 100);
+    Matrix<BaseFloat> feats, noise_vectors;
+    std::vector<bool> silence_decisions;
+    InitRandData(num_frames, feat_dim, &feats, &silence_decisions);
+    noise_vec.ExtractVectors(feats, silence_decisions, &noise_vectors);
+
+    if (utt > 0)
+      stream_vec.StartUtterance(RandInt(0, 1) == 0 ? 0 : num_frames);
+    Vector<BaseFloat> vector(2 * feat_dim);
+    int32 num_done = 0;
+    while (num_done < num_frames) {
+      int32 this_num_frames = std::min(RandInt(1, 2 * period),
+                                       num_frames - num_done);
+      std::vector<bool> these_decisions(
+          silence_decisions.begin() + num_done,
+          silence_decisions.begin() + num_done + this_num_frames);
+      stream_vec.AcceptFrames(feats.RowRange(num_done, this_num_frames),
+                              these_decisions);
+      num_done += this_num_frames;
+      KALDI_ASSERT(stream_vec.NumFramesAccepted() == num_done &&
+                   stream_vec.NumFramesReady() ==
+                   (num_done / period) * period);
+    }
+    stream_vec.InputFinished();
+    KALDI_ASSERT(stream_vec.NumFramesReady() == num_frames &&
+                 stream_vec.IsLastFrame(num_frames - 1));
+    for (int32 t = 0; t < num_frames; t++) {
+      stream_vec.GetVector(t, &vector);
+      AssertEqual(vector, noise_vectors.Row(t / period));
+    }
+  }
+}
+
+// Checks that "prior1" and "prior2" have the same parameters, to within
+// "tol" (relative).
+static void AssertPriorsEqual(const OnlineNoisePrior &prior1,
+                              const OnlineNoisePrior &prior2,
+                              float tol) {
+  OnlineNoisePriorFactors f1 = prior1.Factors(), f2 = prior2.Factors();
+  KALDI_ASSERT(prior1.Dim() == prior2.Dim() &&
+               f1.FeatDim() == f2.FeatDim());
+  AssertEqual(f1.MuN(), f2.MuN(), tol);
+  AssertEqual(f1.A(), f2.A(), tol);
+  AssertEqual(f1.B(), f2.B(), tol);
+  AssertEqual(f1.LambdaN(), f2.LambdaN(), tol);
+  AssertEqual(f1.LambdaS(), f2.LambdaS(), tol);
+  AssertEqual(f1.BtLambdaS(), f2.BtLambdaS(), tol);
+  AssertEqual(f1.BtLambdaSA(), f2.BtLambdaSA(), tol);
+  AssertEqual(f1.ScaleSpeech(), f2.ScaleSpeech(), tol);
+  AssertEqual(f1.ScaleNoise(), f2.ScaleNoise(), tol);
+}
+
+// Checks that extractors using "prior1" and "prior2" give the same
+// vectors, to within "tol" (relative).
+static void AssertSameVectors(const OnlineNoisePriorFactors &prior1,
+                              const OnlineNoisePriorFactors &prior2,
+                              float tol) {
+  int32 period = RandInt(1, 10);
+  Matrix<BaseFloat> feats, noise_vectors1, noise_vectors2;
+  std::vector<bool> silence_decisions;
+  InitRandData(RandInt(1, 100), prior1.FeatDim(), &feats,
+               &silence_decisions);
+  OnlineNoiseVector noise_vec1(prior1, period), noise_vec2(prior2, period);
+  noise_vec1.ExtractVectors(feats, silence_decisions, &noise_vectors1);
+  noise_vec2.ExtractVectors(feats, silence_decisions, &noise_vectors2);
+  AssertEqual(noise_vectors1, noise_vectors2, tol);
+}
+
+void UnitTestPriorIo() {
+  int32 feat_dim = RandInt(2, 20);
+  OnlineNoisePrior prior;
+  InitRandPrior(feat_dim, &prior);
+  for (int32 i = 0; i < 2; i++) {
+    bool binary = (i == 0);
+    std::ostringstream os;
+    prior.Write(os, binary);
+    OnlineNoisePrior prior2;
+    std::istringstream is(os.str());
+    prior2.Read(is, binary);
+    // The text format does not keep all the digits of the parameters,
+    // and the derived variables are recomputed from them.
+    float tol = (binary ? 1.0e-06 : 1.0e-03);
+    AssertPriorsEqual(prior, prior2, tol);
+    AssertSameVectors(prior.Factors(), prior2.Factors(), tol);
+  }
+}
+
+void UnitTestPriorCopy() {
+  int32 feat_dim = RandInt(2, 20);
+  OnlineNoisePrior prior;
+  InitRandPrior(feat_dim, &prior);
+
+  // The copies must own their parameters: they should be unchanged, and
+  // still usable, after the original is re-estimated.
+  OnlineNoisePrior reference(prior), copied(prior), assigned;
+  InitRandPrior(RandInt(2, 20), &assigned);
+  assigned = prior;
+  InitRandPrior(feat_dim, &prior);
+  KALDI_ASSERT(copied.Factors().MuN().Data() !=
+               prior.Factors().MuN().Data());
+  AssertPriorsEqual(reference, copied, 0.0);
+  AssertPriorsEqual(reference, assigned, 0.0);
+  AssertSameVectors(reference.Factors(), copied.Factors(), 0.0);
+  AssertSameVectors(reference.Factors(), assigned.Factors(), 0.0);
+
+  // Self-assignment is a no-op.
+  const OnlineNoisePrior &same = assigned;
+  assigned = same;
+  AssertPriorsEqual(reference, assigned, 0.0);
+
+  // The factors are a view of the prior, so copying or assigning them
+  // refers to the same parameters.
+  OnlineNoisePriorFactors factors(reference.Factors()), assigned_factors;
+  KALDI_ASSERT(assigned_factors.FeatDim() == 0);
+  assigned_factors = factors;
+  KALDI_ASSERT(factors.MuN().Data() == reference.Factors().MuN().Data() &&
+               assigned_factors.MuN().Data() ==
+               reference.Factors().MuN().Data());
+  AssertSameVectors(reference.Factors(), assigned_factors, 0.0);
+}
+
+}  // namespace kaldi
+
+int main() {
+  using namespace kaldi;
+  SetVerboseLevel(2);
+  for (int32 i = 0; i < 10; i++) {
+    UnitTestExtractVectors();
+    UnitTestStreaming();
+    UnitTestPriorIo();
+    UnitTestPriorCopy();
+  }
+  KALDI_LOG << "Tests succeeded.";
+  return 0;
+}
@@ -17,6 +17,16 @@
 // See the Apache 2 License for the specific language governing permissions and
 // limitations under the License.
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <unordered_set>
+
 #include "ivector/online-noise-vector.h"
 
 namespace kaldi {
@@ -43,6 +53,329 @@ void OnlineNoisePrior::Read(std::istream &is, bool binary) {
   ReadBasicType(is, binary, &r_s_);
   ReadBasicType(is, binary, &r_n_);
   ExpectToken(is, binary, "</OnlineNoisePrior>");
+  ComputeDerivedVars();
+}
+
+void OnlineNoisePrior::ComputeDerivedVars() {
+  int32 dim = a_.Dim();
+  mu_n_double_ = Vector<double>(mu_n_);
+  a_double_ = Vector<double>(a_);
+  B_double_ = Matrix<double>(B_);
+  const Matrix<double> &B = B_double_;
+  Lambda_s_double_ = Matrix<double>(Lambda_s_);
+  Lambda_n_double_ = Matrix<double>(Lambda_n_);
+  SpMatrix<double> Lambda_s(dim), Lambda_n(dim);
+  Lambda_s.CopyFromMat(Lambda_s_double_, kTakeMean);
+  Lambda_n.CopyFromMat(Lambda_n_double_, kTakeMean);
+  BtLambda_s_.Resize(dim, dim);
+  BtLambda_s_.AddMatSp(1.0, B, kTrans, Lambda_s, 0.0);
+  BtLambda_s_a_.Resize(dim);
+  BtLambda_s_a_.AddMatVec(1.0, BtLambda_s_, kNoTrans, a_double_, 0.0);
+
+  // Simultaneous diagonalization of Lambda_n and M = B^T Lambda_s B.
+  // With Lambda_n = C C^T, we diagonalize C^{-1} M C^{-T} = U diag(psi) U^T,
+  // and then W = U^T C^{-1}. The matrix that appears in the solve,
+  // noise_scale * Lambda_n + gamma * M, has inverse
+  // W^T diag(1 / (noise_scale + gamma * psi)) W.
+  TpMatrix<double> C(dim);
+  C.Cholesky(Lambda_n);
+  C.Invert();
+  Matrix<double> C_inv(dim, dim);
+  C_inv.CopyFromTp(C, kNoTrans);
+  SpMatrix<double> M(dim), M_proj(dim);
+  M.AddMat2Sp(1.0, B, kTrans, Lambda_s, 0.0);
+  M_proj.AddMat2Sp(1.0, C_inv, kNoTrans, M, 0.0);
+  Matrix<double> U(dim, dim);
+  psi_.Resize(dim);
+  M_proj.Eig(&psi_, &U);
+  transform_.Resize(dim, dim);
+  transform_.AddMatMat(1.0, U, kTrans, C_inv, kNoTrans, 0.0);
+}
+
+OnlineNoisePriorFactors::OnlineNoisePriorFactors():
+    dim_(0), stride_(0), r_s_(0.0), r_n_(0.0), mu_n_(NULL), a_(NULL),
+    B_(NULL), Lambda_n_(NULL), Lambda_s_(NULL), BtLambda_s_(NULL),
+    BtLambda_s_a_(NULL), transform_(NULL), psi_(NULL) { }
+
+void OnlineNoisePriorFactors::SolvePosteriorMean(
+    double speech_scale, double noise_scale,
+    const VectorBase<double> &speech_term,
+    const VectorBase<double> &noise_term,
+    VectorBase<double> *x) const {
+  int32 dim = dim_;
+  KALDI_ASSERT(speech_term.Dim() == dim && noise_term.Dim() == dim &&
+               x->Dim() == 2 * dim && speech_scale > 0.0);
+  // Eliminating the speech block from K x = Q gives
+  // (noise_scale Lambda_n + (1 - 1/speech_scale) B^T Lambda_s B) x_n
+  //     = Q_2 + B^T Q_1 / speech_scale,
+  // and then x_s = (Lambda_s^{-1} Q_1 + B x_n) / speech_scale.
+  double gamma = 1.0 - 1.0 / speech_scale;
+  Vector<double> rhs(noise_term), proj(dim);
+  rhs.AddMatVec(1.0 / speech_scale, BtLambdaS(), kNoTrans, speech_term, 1.0);
+  SubMatrix<double> transform(Mat(transform_));
+  SubVector<double> psi(Vec(psi_));
+  proj.AddMatVec(1.0, transform, kNoTrans, rhs, 0.0);
+  for (int32 i = 0; i < dim; i++)
+    proj(i) /= noise_scale + gamma * psi(i);
+  SubVector<double> x_s(*x, 0, dim), x_n(*x, dim, dim);
+  x_n.AddMatVec(1.0, transform, kTrans, proj, 0.0);
+  x_s.CopyFromVec(speech_term);
+  x_s.AddMatVec(1.0, B(), kNoTrans, x_n, 1.0);
+  x_s.Scale(1.0 / speech_scale);
+}
+
+void OnlineNoisePriorFactors::SolvePosteriorMeans(
+    const VectorBase<double> &speech_scales,
+    const VectorBase<double> &noise_scales,
+    const MatrixBase<double> &speech_terms,
+    const MatrixBase<double> &noise_terms,
+    MatrixBase<double> *x) const {
+  int32 dim = dim_, num_rows = speech_scales.Dim();
+  KALDI_ASSERT(noise_scales.Dim() == num_rows &&
+               speech_terms.NumRows() == num_rows &&
+               speech_terms.NumCols() == dim &&
+               noise_terms.NumRows() == num_rows &&
+               noise_terms.NumCols() == dim &&
+               x->NumRows() == num_rows && x->NumCols() == 2 * dim &&
+               speech_scales.Min() > 0.0);
+  // This is SolvePosteriorMean() with the vectors as rows; see there
+  // for the math.
+  Vector<double> inv_speech_scales(speech_scales);
+  inv_speech_scales.InvertElements();
+  Matrix<double> scaled_speech(speech_terms);
+  scaled_speech.MulRowsVec(inv_speech_scales);
+  Matrix<double> rhs(noise_terms), proj(num_rows, dim, kUndefined);
+  rhs.AddMatMat(1.0, scaled_speech, kNoTrans, BtLambdaS(), kTrans, 1.0);
+  SubMatrix<double> transform(Mat(transform_));
+  SubVector<double> psi(Vec(psi_));
+  proj.AddMatMat(1.0, rhs, kNoTrans, transform, kTrans, 0.0);
+  for (int32 r = 0; r < num_rows; r++) {
+    double gamma = 1.0 - inv_speech_scales(r), noise_scale = noise_scales(r);
+    double *proj_data = proj.RowData(r);
+    for (int32 i = 0; i < dim; i++)
+      proj_data[i] /= noise_scale + gamma * psi(i);
+  }
+  SubMatrix<double> x_s(*x, 0, num_rows, 0, dim),
+      x_n(*x, 0, num_rows, dim, dim);
+  x_n.AddMatMat(1.0, proj, kNoTrans, transform, kNoTrans, 0.0);
+  x_s.AddMatMat(1.0, x_n, kNoTrans, B(), kTrans, 0.0);
+  x_s.MulRowsVec(inv_speech_scales);
+  x_s.AddMat(1.0, scaled_speech);
+}
+
+OnlineNoisePrior &OnlineNoisePrior::operator = (
+    const OnlineNoisePrior &other) {
+  if (this == &other)
+    return *this;
+  mu_n_ = other.mu_n_;
+  a_ = other.a_;
+  B_ = other.B_;
+  Lambda_n_ = other.Lambda_n_;
+  Lambda_s_ = other.Lambda_s_;
+  r_s_ = other.r_s_;
+  r_n_ = other.r_n_;
+  mu_n_double_ = other.mu_n_double_;
+  a_double_ = other.a_double_;
+  B_double_ = other.B_double_;
+  Lambda_n_double_ = other.Lambda_n_double_;
+  Lambda_s_double_ = other.Lambda_s_double_;
+  BtLambda_s_ = other.BtLambda_s_;
+  BtLambda_s_a_ = other.BtLambda_s_a_;
+  transform_ = other.transform_;
+  psi_ = other.psi_;
+  return *this;
+}
+
+OnlineNoisePriorFactors OnlineNoisePrior::Factors() const {
+  OnlineNoisePriorFactors factors;
+  factors.dim_ = a_double_.Dim();
+  if (factors.dim_ == 0)
+    return factors;
+  factors.stride_ = B_double_.Stride();
+  KALDI_ASSERT(Lambda_n_double_.Stride() == factors.stride_ &&
+               Lambda_s_double_.Stride() == factors.stride_ &&
+               BtLambda_s_.Stride() == factors.stride_ &&
+               transform_.Stride() == factors.stride_);
+  factors.r_s_ = r_s_;
+  factors.r_n_ = r_n_;
+  factors.mu_n_ = mu_n_double_.Data();
+  factors.a_ = a_double_.Data();
+  factors.B_ = B_double_.Data();
+  factors.Lambda_n_ = Lambda_n_double_.Data();
+  factors.Lambda_s_ = Lambda_s_double_.Data();
+  factors.BtLambda_s_ = BtLambda_s_.Data();
+  factors.BtLambda_s_a_ = BtLambda_s_a_.Data();
+  factors.transform_ = transform_.Data();
+  factors.psi_ = psi_.Data();
+  return factors;
+}
+
+// The layout of the files read by MappedOnlineNoisePrior: the header
+// below, then the arrays, each starting at a multiple of
+// kMappedPriorAlignment bytes. Matrices are stored row by row with a row
+// stride that is also a multiple of the alignment. Everything is in
+// native byte order; the byte order mark detects files from a machine
+// with the other one. The version is increased when the layout changes.
+static const char kMappedPriorMagic[8] = { 'K', 'N', 'V', 'P',
+                                           'R', 'I', 'O', 'R' };
+static const uint32 kMappedPriorVersion = 2;
+static const uint32 kMappedPriorByteOrderMark = 0x01020304;
+static const size_t kMappedPriorAlignment = 64;
+
+enum MappedPriorArray {
+  kMappedMuN = 0, kMappedA, kMappedPsi, kMappedBtLambdaSA,  // vectors
+  kMappedB, kMappedLambdaN, kMappedLambdaS, kMappedBtLambdaS,
+  kMappedTransform,  // matrices
+  kMappedNumArrays
+};
+
+struct MappedPriorHeader {
+  char magic[8];
+  uint32 version;
+  uint32 byte_order_mark;
+  int32 dim;
+  int32 stride;  // Row stride of the matrices, in doubles.
+  double r_s;
+  double r_n;
+  uint64 offsets[kMappedNumArrays];  // In bytes from the start of file.
+  uint64 file_size;
+};
+
+static size_t RoundUpToAlignment(size_t n) {
+  return ((n + kMappedPriorAlignment - 1) / kMappedPriorAlignment) *
+      kMappedPriorAlignment;
+}
+
+// Fills in the stride, offsets and file size of "header" from its dim.
+static void ComputeMappedPriorLayout(MappedPriorHeader *header) {
+  size_t doubles_per_unit = kMappedPriorAlignment / sizeof(double),
+      stride = RoundUpToAlignment(header->dim * sizeof(double)) /
+      sizeof(double),
+      vector_bytes = RoundUpToAlignment(header->dim * sizeof(double)),
+      matrix_bytes = header->dim * stride * sizeof(double),
+      offset = RoundUpToAlignment(sizeof(MappedPriorHeader));
+  KALDI_ASSERT(stride % doubles_per_unit == 0);
+  header->stride = stride;
+  for (int32 i = 0; i < kMappedNumArrays; i++) {
+    header->offsets[i] = offset;
+    offset += (i < kMappedB ? vector_bytes : RoundUpToAlignment(matrix_bytes));
+  }
+  header->file_size = offset;
+}
+
+void OnlineNoisePrior::WriteMapped(const std::string &wxfilename) const {
+  int32 dim = a_double_.Dim();
+  if (dim == 0)
+    KALDI_ERR << "Writing an empty noise prior.";
+  MappedPriorHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, kMappedPriorMagic, sizeof(header.magic));
+  header.version = kMappedPriorVersion;
+  header.byte_order_mark = kMappedPriorByteOrderMark;
+  header.dim = dim;
+  header.r_s = r_s_;
+  header.r_n = r_n_;
+  ComputeMappedPriorLayout(&header);
+
+  std::vector<char> buffer(header.file_size, 0);
+  std::memcpy(&(buffer[0]), &header, sizeof(header));
+  const VectorBase<double> *vectors[] = { &mu_n_double_, &a_double_, &psi_,
+                                          &BtLambda_s_a_ };
+  for (int32 i = kMappedMuN; i < kMappedB; i++)
+    std::memcpy(&(buffer[header.offsets[i]]), vectors[i]->Data(),
+                dim * sizeof(double));
+  const MatrixBase<double> *matrices[] = { &B_double_, &Lambda_n_double_,
+                                           &Lambda_s_double_, &BtLambda_s_,
+                                           &transform_ };
+  for (int32 i = kMappedB; i < kMappedNumArrays; i++) {
+    const MatrixBase<double> &mat = *(matrices[i - kMappedB]);
+    for (int32 r = 0; r < dim; r++)
+      std::memcpy(&(buffer[header.offsets[i] +
+                           r * header.stride * sizeof(double)]),
+                  mat.RowData(r), dim * sizeof(double));
+  }
+  Output ko(wxfilename, true, false);
+  ko.Stream().write(&(buffer[0]), buffer.size());
+  if (!ko.Close())
+    KALDI_ERR << "Failed to write mapped noise prior to "
+              << PrintableWxfilename(wxfilename);
+}
+
+bool MappedOnlineNoisePrior::IsMappedPriorFile(
+    const std::string &rxfilename) {
+  if (ClassifyRxfilename(rxfilename) != kFileInput)
+    return false;
+  std::ifstream is(rxfilename.c_str(), std::ios::binary);
+  char magic[sizeof(kMappedPriorMagic)];
+  if (!is.read(magic, sizeof(magic)))
+    return false;
+  return std::memcmp(magic, kMappedPriorMagic, sizeof(magic)) == 0;
+}
+
+void MappedOnlineNoisePrior::Open(const std::string &filename) {
+  KALDI_ASSERT(data_ == NULL && "Open() called twice.");
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0)
+    KALDI_ERR << "Could not open mapped noise prior " << filename << ": "
+              << strerror(errno);
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(MappedPriorHeader))) {
+    close(fd);
+    KALDI_ERR << "Mapped noise prior " << filename << " is too small.";
+  }
+  size_t size = st.st_size;
+  void *data = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);  // The mapping keeps the file open.
+  if (data == MAP_FAILED)
+    KALDI_ERR << "Could not map noise prior " << filename << ": "
+              << strerror(errno);
+  data_ = data;
+  size_ = size;
+
+  MappedPriorHeader header;
+  std::memcpy(&header, data_, sizeof(header));
+  if (std::memcmp(header.magic, kMappedPriorMagic, sizeof(header.magic)))
+    KALDI_ERR << filename << " is not a mapped noise prior.";
+  if (header.byte_order_mark != kMappedPriorByteOrderMark)
+    KALDI_ERR << "Mapped noise prior " << filename
+              << " was written on a machine with a different byte order.";
+  if (header.version != kMappedPriorVersion)
+    KALDI_ERR << "Mapped noise prior " << filename << " has version "
+              << header.version << ", expected " << kMappedPriorVersion
+              << "; convert the prior again with copy-noise-prior "
+              << "--mapped=true.";
+  MappedPriorHeader expected;
+  std::memset(&expected, 0, sizeof(expected));
+  expected.dim = header.dim;
+  if (header.dim > 0)
+    ComputeMappedPriorLayout(&expected);
+  if (header.dim <= 0 || header.stride != expected.stride ||
+      header.file_size != expected.file_size || header.file_size != size_ ||
+      std::memcmp(header.offsets, expected.offsets, sizeof(header.offsets)))
+    KALDI_ERR << "Mapped noise prior " << filename << " is corrupted.";
+
+  const char *base = static_cast<const char*>(data_);
+  const double *arrays[kMappedNumArrays];
+  for (int32 i = 0; i < kMappedNumArrays; i++)
+    arrays[i] = reinterpret_cast<const double*>(base + header.offsets[i]);
+  factors_.dim_ = header.dim;
+  factors_.stride_ = header.stride;
+  factors_.r_s_ = header.r_s;
+  factors_.r_n_ = header.r_n;
+  factors_.mu_n_ = arrays[kMappedMuN];
+  factors_.a_ = arrays[kMappedA];
+  factors_.psi_ = arrays[kMappedPsi];
+  factors_.B_ = arrays[kMappedB];
+  factors_.Lambda_n_ = arrays[kMappedLambdaN];
+  factors_.Lambda_s_ = arrays[kMappedLambdaS];
+  factors_.BtLambda_s_ = arrays[kMappedBtLambdaS];
+  factors_.BtLambda_s_a_ = arrays[kMappedBtLambdaSA];
+  factors_.transform_ = arrays[kMappedTransform];
+}
+
+MappedOnlineNoisePrior::~MappedOnlineNoisePrior() {
+  if (data_ != NULL)
+    munmap(data_, size_);
 }
 
 int32 OnlineNoisePrior::Dim() const {
@@ -77,6 +410,7 @@ void OnlineNoisePrior::EstimatePriorParameters(
   a_.AddMatVec(-1.0, temp, kNoTrans, mu_n_, 1);
   r_s_ = scale;
   r_n_ = scale;
+  ComputeDerivedVars();
 }
 
 void OnlineNoisePrior::EstimatePriorParameters(
@@ -96,42 +430,439 @@ void OnlineNoisePrior::EstimatePriorParameters(
 
 }
 
+OnlineNoisePriorStats::OnlineNoisePriorStats(int32 dim):
+    count_(0.0), mean_(dim), scatter_(dim) { }
+
+void OnlineNoisePriorStats::AccStats(
+    const VectorBase<BaseFloat> &noise_vector) {
+  KALDI_ASSERT(noise_vector.Dim() == Dim());
+  // Welford's update: with delta = x - old_mean, the scatter grows by
+  // (n - 1) / n * delta delta^T.
+  count_ += 1.0;
+  Vector<double> delta(noise_vector);
+  delta.AddVec(-1.0, mean_);
+  mean_.AddVec(1.0 / count_, delta);
+  scatter_.AddVec2((count_ - 1.0) / count_, delta);
+}
+
+void OnlineNoisePriorStats::Add(const OnlineNoisePriorStats &other) {
+  if (other.count_ == 0.0)
+    return;
+  if (count_ == 0.0) {
+    *this = other;
+    return;
+  }
+  KALDI_ASSERT(other.Dim() == Dim());
+  // Chan et al.'s update for merging two sets of statistics: with
+  // delta = other_mean - mean, the scatter grows by the other scatter
+  // plus n_a n_b / (n_a + n_b) * delta delta^T.
+  double tot_count = count_ + other.count_;
+  Vector<double> delta(other.mean_);
+  delta.AddVec(-1.0, mean_);
+  mean_.AddVec(other.count_ / tot_count, delta);
+  scatter_.AddSp(1.0, other.scatter_);
+  scatter_.AddVec2(count_ * other.count_ / tot_count, delta);
+  count_ = tot_count;
+}
+
+void OnlineNoisePriorStats::Write(std::ostream &os, bool binary) const {
+  WriteToken(os, binary, "<OnlineNoisePriorStats>");
+  WriteToken(os, binary, "<Count>");
+  WriteBasicType(os, binary, count_);
+  WriteToken(os, binary, "<Mean>");
+  mean_.Write(os, binary);
+  WriteToken(os, binary, "<Scatter>");
+  scatter_.Write(os, binary);
+  WriteToken(os, binary, "</OnlineNoisePriorStats>");
+}
+
+void OnlineNoisePriorStats::Read(std::istream &is, bool binary, bool add) {
+  OnlineNoisePriorStats other;
+  ExpectToken(is, binary, "<OnlineNoisePriorStats>");
+  ExpectToken(is, binary, "<Count>");
+  ReadBasicType(is, binary, &other.count_);
+  ExpectToken(is, binary, "<Mean>");
+  other.mean_.Read(is, binary);
+  ExpectToken(is, binary, "<Scatter>");
+  other.scatter_.Read(is, binary);
+  ExpectToken(is, binary, "</OnlineNoisePriorStats>");
+  if (add)
+    Add(other);
+  else
+    *this = other;
+}
+
+int32 AccumulateNoisePriorStats(const std::string &noise_vec_rspecifier,
+                                bool skip_dup_check,
+                                OnlineNoisePriorStats *stats,
+                                int32 *num_err) {
+  SequentialBaseFloatVectorReader noise_vec_reader(noise_vec_rspecifier);
+  // Only the keys are kept, never more than one noise vector.
+  std::unordered_set<std::string, StringHasher> seen_utts;
+  int32 num_done = 0;
+  for (; !noise_vec_reader.Done(); noise_vec_reader.Next()) {
+    std::string utt = noise_vec_reader.Key();
+    const Vector<BaseFloat> &noise_vector = noise_vec_reader.Value();
+    if (!skip_dup_check && !seen_utts.insert(utt).second) {
+      KALDI_WARN << "Duplicate noise vector found for utterance " << utt
+                 << ", ignoring it.";
+      (*num_err)++;
+      continue;
+    }
+    if (stats->Dim() == 0) {
+      *stats = OnlineNoisePriorStats(noise_vector.Dim());
+    } else if (stats->Dim() != noise_vector.Dim()) {
+      KALDI_WARN << "Noise vector dimension mismatch for utterance " << utt
+                 << ": " << noise_vector.Dim() << " vs. " << stats->Dim();
+      (*num_err)++;
+      continue;
+    }
+    stats->AccStats(noise_vector);
+    num_done++;
+  }
+  return num_done;
+}
+
+void OnlineNoisePriorStats::GetMeanAndCovariance(
+    Vector<BaseFloat> *mean,
+    SpMatrix<BaseFloat> *covariance) const {
+  if (count_ < 2.0)
+    KALDI_ERR << "Need at least 2 noise vectors to estimate the covariance, "
+              << "got " << count_;
+  mean->Resize(Dim());
+  mean->CopyFromVec(mean_);
+  SpMatrix<double> cov(scatter_);
+  cov.Scale(1.0 / (count_ - 1.0));
+  covariance->Resize(Dim());
+  covariance->CopyFromSp(cov);
+}
+
 OnlineNoiseVector::OnlineNoiseVector(
     const OnlineNoisePrior &noise_prior,
-    const int32 period):
-    period_(period), num_speech_(0), num_noise_(0) {
-  dim_ = noise_prior.Dim();
-  current_vector_ = Vector<BaseFloat>(dim_);
-  prior_.mu_n_ = noise_prior.mu_n_;
-  prior_.a_ = noise_prior.a_;
-  prior_.B_ = noise_prior.B_;
-  prior_.Lambda_n_ = noise_prior.Lambda_n_;
-  prior_.Lambda_s_ = noise_prior.Lambda_s_;
-  prior_.r_s_ = noise_prior.r_s_;
-  prior_.r_n_ = noise_prior.r_n_;
-  // initialize statistic variables
-  speech_sum_.Resize(dim_/2);
-  noise_sum_.Resize(dim_/2);
-  speech_var_.Resize(dim_/2, dim_/2);
-  noise_var_.Resize(dim_/2, dim_/2);
+    const int32 period,
+    BaseFloat forgetting_factor):
+    OnlineNoiseVector(noise_prior.Factors(), period, forgetting_factor) { }
+
+OnlineNoiseVector::OnlineNoiseVector(
+    const OnlineNoisePriorFactors &prior_factors,
+    const int32 period,
+    BaseFloat forgetting_factor):
+    prior_(prior_factors), period_(period),
+    forgetting_factor_(forgetting_factor),
+    dim_(2 * prior_factors.FeatDim()),
+    r_s_(prior_factors.ScaleSpeech()), r_n_(prior_factors.ScaleNoise()),
+    current_vector_(dim_), num_speech_(0), num_noise_(0),
+    speech_sum_(dim_/2), noise_sum_(dim_/2),
+    speech_var_(dim_/2, dim_/2), noise_var_(dim_/2, dim_/2),
+    num_frames_(0), input_finished_(false), num_vectors_(0),
+    low_latency_(false), timing_info_(NULL) {
+  KALDI_ASSERT(dim_ > 0 && "Noise prior was not initialized.");
+  KALDI_ASSERT(period > 0 && forgetting_factor > 0.0 &&
+               forgetting_factor <= 1.0);
+}
+
+OnlineNoiseVector::OnlineNoiseVector(
+    const int32 feat_dim,
+    const int32 period,
+    BaseFloat forgetting_factor):
+    period_(period),
+    forgetting_factor_(forgetting_factor), dim_(2 * feat_dim),
+    r_s_(0.0), r_n_(0.0),
+    current_vector_(dim_), num_speech_(0), num_noise_(0),
+    speech_sum_(feat_dim), noise_sum_(feat_dim),
+    speech_var_(feat_dim, feat_dim), noise_var_(feat_dim, feat_dim),
+    num_frames_(0), input_finished_(false), num_vectors_(0),
+    low_latency_(false), timing_info_(NULL) {
+  KALDI_ASSERT(feat_dim > 0 && period > 0 && forgetting_factor > 0.0 &&
+               forgetting_factor <= 1.0);
 }
 
 void OnlineNoiseVector::ExtractVectors(
-    const Matrix<BaseFloat> &feats,
+    const MatrixBase<BaseFloat> &feats,
     const std::vector<bool> &silence_decisions,
     Matrix<BaseFloat> *noise_vectors) {
-  int32 num_vectors = (feats.NumRows() + period_ - 1)/period_, num_done = 0;
-  noise_vectors->Resize(num_vectors, dim_);
-  for (int32 i = 0; i < num_vectors; ++i) {
-    int32 num_rows = std::min(period_, feats.NumRows() - num_done);
-    SubMatrix<BaseFloat> cur_feats(feats, i*period_, num_rows, 0, dim_/2);
-    std::vector<bool>::const_iterator first = silence_decisions.begin() + i*period_;
-    std::vector<bool>::const_iterator last = silence_decisions.begin() + i*period_ + num_rows;
-    std::vector<bool> cur_decisions(first, last);
-    UpdateVector(cur_feats, cur_decisions);
-    UpdateScalingParams(cur_feats, cur_decisions);
-    noise_vectors->CopyRowFromVec(current_vector_, i);
-    num_done += num_rows;
+  StartUtterance(feats.NumRows());
+  AcceptFrames(feats, silence_decisions);
+  InputFinished();
+  noise_vectors->Resize(num_vectors_, dim_, kUndefined);
+  if (num_vectors_ > 0)
+    noise_vectors->CopyFromMat(vectors_history_.RowRange(0, num_vectors_));
+}
+
+void OnlineNoiseVector::ExtractVectorsBatch(
+    const std::vector<OnlineNoiseVector*> &extractors,
+    const std::vector<const MatrixBase<BaseFloat>*> &feats,
+    const std::vector<const std::vector<bool>*> &silence_decisions,
+    std::vector<Matrix<BaseFloat> > *noise_vectors) {
+  int32 num_utts = extractors.size();
+  KALDI_ASSERT(static_cast<int32>(feats.size()) == num_utts &&
+               static_cast<int32>(silence_decisions.size()) == num_utts);
+  noise_vectors->resize(num_utts);
+  if (num_utts == 0)
+    return;
+  OnlineNoiseVector *first = extractors[0];
+  if (first->IsMle()) {
+    for (int32 n = 0; n < num_utts; n++)
+      extractors[n]->ExtractVectors(*(feats[n]),
+                                    *(silence_decisions[n]),
+                                    &((*noise_vectors)[n]));
+    return;
+  }
+  int32 period = first->period_, max_frames = 0;
+  for (int32 n = 0; n < num_utts; n++) {
+    OnlineNoiseVector *extractor = extractors[n];
+    if (extractor->IsMle() || extractor->period_ != period ||
+        extractor->prior_.MuN().Data() != first->prior_.MuN().Data())
+      KALDI_ERR << "Extractors in a batch must share the prior and period.";
+    int32 num_frames = feats[n]->NumRows();
+    KALDI_ASSERT(num_frames ==
+                 static_cast<int32>(silence_decisions[n]->size()));
+    extractor->StartUtterance(num_frames);
+    max_frames = std::max(max_frames, num_frames);
+  }
+  std::vector<OnlineNoiseVector*> batch;
+  batch.reserve(num_utts);
+  BatchWorkspace workspace;
+  int32 feat_dim = first->dim_/2;
+  workspace.speech_terms.Resize(num_utts, feat_dim, kUndefined);
+  workspace.noise_means.Resize(num_utts, feat_dim, kUndefined);
+  workspace.noise_terms.Resize(num_utts, feat_dim, kUndefined);
+  workspace.speech_scales.Resize(num_utts, kUndefined);
+  workspace.noise_scales.Resize(num_utts, kUndefined);
+  workspace.x.Resize(num_utts, 2 * feat_dim, kUndefined);
+  for (int32 start = 0; start < max_frames; start += period) {
+    // Accept this chunk of every utterance that is long enough, then
+    // finish the chunks together.
+    batch.clear();
+    for (int32 n = 0; n < num_utts; n++) {
+      int32 num_frames = feats[n]->NumRows();
+      if (start >= num_frames)
+        continue;
+      OnlineNoiseVector *extractor = extractors[n];
+      int32 this_num_rows = std::min(period, num_frames - start);
+      SubMatrix<BaseFloat> cur_feats(*(feats[n]), start, this_num_rows,
+                                     0, extractor->dim_/2);
+      extractor->AcceptChunkFrames(cur_feats, *(silence_decisions[n]), start);
+      batch.push_back(extractor);
+    }
+    {
+      NoiseVectorStageTimer timer(first->timing_info_ != NULL);
+      UpdateVectorsBatch(batch, &workspace);
+      timer.Stop(first->timing_info_ != NULL ?
+                 &(first->timing_info_->solve) : NULL);
+    }
+    for (size_t i = 0; i < batch.size(); i++)
+      batch[i]->CompleteChunk();
+  }
+  for (int32 n = 0; n < num_utts; n++) {
+    OnlineNoiseVector *extractor = extractors[n];
+    extractor->input_finished_ = true;
+    Matrix<BaseFloat> &vectors = (*noise_vectors)[n];
+    vectors.Resize(extractor->num_vectors_, extractor->dim_, kUndefined);
+    if (extractor->num_vectors_ > 0)
+      vectors.CopyFromMat(
+          extractor->vectors_history_.RowRange(0, extractor->num_vectors_));
+  }
+}
+
+void OnlineNoiseVector::StartUtterance(int32 num_frames) {
+  // Estimate the vector for the last, partial chunk of the previous
+  // utterance if the caller did not.
+  InputFinished();
+  num_frames_ = 0;
+  input_finished_ = false;
+  num_vectors_ = 0;
+  ReserveVectors((num_frames + period_ - 1) / period_);
+}
+
+void OnlineNoiseVector::ReserveVectors(int32 num_vectors) {
+  if (num_vectors <= vectors_history_.NumRows())
+    return;
+  num_vectors = std::max(num_vectors, 2 * vectors_history_.NumRows());
+  vectors_history_.Resize(num_vectors, dim_, kCopyData);
+}
+
+void OnlineNoiseVector::AcceptFrames(
+    const MatrixBase<BaseFloat> &feats,
+    const std::vector<bool> &silence_decisions) {
+  if (input_finished_)
+    KALDI_ERR << "AcceptFrames() called after InputFinished(); call "
+              << "StartUtterance() to start a new utterance.";
+  KALDI_ASSERT(feats.NumRows() == static_cast<int32>(silence_decisions.size()) &&
+               feats.NumCols() >= dim_/2);
+  int32 num_rows = feats.NumRows(), num_done = 0;
+  while (num_done < num_rows) {
+    // Split the input at chunk boundaries.
+    int32 num_in_chunk = num_frames_ % period_,
+        this_num_rows = std::min(period_ - num_in_chunk, num_rows - num_done);
+    SubMatrix<BaseFloat> cur_feats(feats, num_done, this_num_rows, 0, dim_/2);
+    AcceptChunkFrames(cur_feats, silence_decisions, num_done);
+    num_done += this_num_rows;
+    if (num_frames_ % period_ == 0)
+      FinishChunk();
+  }
+}
+
+void OnlineNoiseVector::AcceptChunkFrames(
+    const MatrixBase<BaseFloat> &feats,
+    const std::vector<bool> &silence_decisions,
+    int32 offset) {
+  if (low_latency_)
+    RecordFrameStats(feats, silence_decisions, offset);
+  NoiseVectorStageTimer timer(timing_info_ != NULL);
+  AccumulateStats(feats, silence_decisions, offset);
+  timer.Stop(timing_info_ != NULL ? &(timing_info_->accumulate) : NULL);
+  num_frames_ += feats.NumRows();
+}
+
+void OnlineNoiseVector::InputFinished() {
+  if (input_finished_)
+    return;
+  if (num_frames_ % period_ != 0)
+    FinishChunk();
+  input_finished_ = true;
+}
+
+int32 OnlineNoiseVector::NumFramesReady() const {
+  if (input_finished_)
+    return num_frames_;
+  return (num_frames_ / period_) * period_;
+}
+
+void OnlineNoiseVector::GetVector(int32 frame,
+                                  VectorBase<BaseFloat> *vector) const {
+  KALDI_ASSERT(frame >= 0 && frame < NumFramesReady() &&
+               vector->Dim() == dim_);
+  vector->CopyFromVec(vectors_history_.Row(frame / period_));
+}
+
+void OnlineNoiseVector::SetLowLatency(bool low_latency) {
+  KALDI_ASSERT((num_frames_ == 0 || input_finished_) &&
+               "SetLowLatency() called in the middle of an utterance.");
+  low_latency_ = low_latency;
+  if (low_latency)
+    frame_stats_.Resize(period_, 4 + dim_, kUndefined);
+  else
+    frame_stats_.Resize(0, 0);
+}
+
+void OnlineNoiseVector::RecordFrameStats(
+    const MatrixBase<BaseFloat> &feats,
+    const std::vector<bool> &silence_decisions,
+    int32 offset) {
+  int32 dim = dim_/2, num_rows = feats.NumRows(),
+      first_row = num_frames_ % period_;
+  KALDI_ASSERT(first_row + num_rows <= period_);
+  for (int32 i = 0; i < num_rows; i++) {
+    SubVector<double> stats(frame_stats_, first_row + i);
+    if (i == 0) {
+      // Start from the statistics before this block; if it starts a
+      // chunk, the forgetting factor and the new scaling factors have
+      // already been applied to them.
+      stats(0) = num_speech_;
+      stats(1) = num_noise_;
+      stats(2) = r_s_;
+      stats(3) = r_n_;
+      stats.Range(4, dim).CopyFromVec(speech_sum_);
+      stats.Range(4 + dim, dim).CopyFromVec(noise_sum_);
+    } else {
+      stats.CopyFromVec(frame_stats_.Row(first_row + i - 1));
+    }
+    if (silence_decisions[offset + i]) {
+      stats(1) += 1.0;
+      stats.Range(4 + dim, dim).AddVec(1.0, feats.Row(i));
+    } else {
+      stats(0) += 1.0;
+      stats.Range(4, dim).AddVec(1.0, feats.Row(i));
+    }
+  }
+}
+
+void OnlineNoiseVector::GetFrameVector(int32 frame,
+                                       VectorBase<BaseFloat> *vector) const {
+  if (!low_latency_)
+    KALDI_ERR << "GetFrameVector() requires low-latency mode "
+              << "(see SetLowLatency()).";
+  int32 chunk_start = ((num_frames_ - 1) / period_) * period_;
+  if (frame < chunk_start || frame >= num_frames_)
+    KALDI_ERR << "GetFrameVector() called for frame " << frame
+              << ", but only frames " << chunk_start << " to "
+              << (num_frames_ - 1) << " of the current chunk are kept.";
+  KALDI_ASSERT(vector->Dim() == dim_);
+  int32 dim = dim_/2;
+  SubVector<double> stats(frame_stats_, frame % period_);
+  ComputeVector(stats(0), stats(1), stats.Range(4, dim),
+                stats.Range(4 + dim, dim), stats(2), stats(3), vector);
+}
+
+void OnlineNoiseVector::ExtractFrameVectors(
+    const MatrixBase<BaseFloat> &feats,
+    const std::vector<bool> &silence_decisions,
+    Matrix<BaseFloat> *frame_vectors) {
+  if (!low_latency_)
+    KALDI_ERR << "ExtractFrameVectors() requires low-latency mode "
+              << "(see SetLowLatency()).";
+  int32 num_rows = feats.NumRows();
+  KALDI_ASSERT(num_rows == static_cast<int32>(silence_decisions.size()) &&
+               feats.NumCols() >= dim_/2);
+  StartUtterance(num_rows);
+  frame_vectors->Resize(num_rows, dim_, kUndefined);
+  for (int32 start = 0; start < num_rows; start += period_) {
+    // The frames of each chunk are queried before the next chunk
+    // overwrites their records.
+    int32 this_num_rows = std::min(period_, num_rows - start);
+    SubMatrix<BaseFloat> cur_feats(feats, start, this_num_rows, 0, dim_/2);
+    AcceptChunkFrames(cur_feats, silence_decisions, start);
+    {
+      NoiseVectorStageTimer timer(timing_info_ != NULL);
+      for (int32 t = start; t < start + this_num_rows; t++) {
+        SubVector<BaseFloat> frame_vector(*frame_vectors, t);
+        GetFrameVector(t, &frame_vector);
+      }
+      timer.Stop(timing_info_ != NULL ? &(timing_info_->solve) : NULL);
+    }
+    if (num_frames_ % period_ == 0)
+      FinishChunk();
+  }
+  InputFinished();
+}
+
+void OnlineNoiseVector::FinishChunk() {
+  {
+    NoiseVectorStageTimer timer(timing_info_ != NULL);
+    UpdateVector();
+    timer.Stop(timing_info_ != NULL ? &(timing_info_->solve) : NULL);
+  }
+  CompleteChunk();
+}
+
+void OnlineNoiseVector::CompleteChunk() {
+  if (!IsMle()) {
+    NoiseVectorStageTimer timer(timing_info_ != NULL);
+    UpdateScalingParams();
+    timer.Stop(timing_info_ != NULL ? &(timing_info_->scale_update) : NULL);
+  }
+  ReserveVectors(num_vectors_ + 1);
+  vectors_history_.CopyRowFromVec(current_vector_, num_vectors_++);
+  if (forgetting_factor_ != 1.0) {
+    // The number of frames in the chunk just finished (the last one of
+    // an utterance may be partial).
+    int32 chunk_frames = num_frames_ - ((num_frames_ - 1) / period_) * period_;
+    ScaleStats(std::pow(forgetting_factor_, chunk_frames));
+  }
+}
+
+void OnlineNoiseVector::ScaleStats(BaseFloat scale) {
+  // Counts, sums and scatters are all scaled alike, so the means and the
+  // scaling factors from UpdateScalingParams() are estimated from the
+  // same weighted frames.
+  num_speech_ *= scale;
+  num_noise_ *= scale;
+  speech_sum_.Scale(scale);
+  noise_sum_.Scale(scale);
+  if (!IsMle()) {
+    speech_var_.Scale(scale);
+    noise_var_.Scale(scale);
   }
 }
 
@@ -140,98 +871,386 @@ void OnlineNoiseVector::ExtractVectors(
     Matrix<BaseFloat> *noise_vectors) {
   int32 num_rows = (feats.NumRows() + period_ - 1)/period_;
   noise_vectors->Resize(num_rows, dim_);
+  if (IsMle())
+    return;
   Vector<BaseFloat> noise_vec(dim_);
   SubVector<BaseFloat> speech_mean(noise_vec, 0, dim_/2);
   SubVector<BaseFloat> sil_mean(noise_vec, dim_/2, dim_/2);
-  sil_mean.AddVec(1.0, prior_.mu_n_);
-  speech_mean.AddVec(1.0, prior_.a_);
-  speech_mean.AddMatVec(1.0, prior_.B_, kNoTrans, prior_.mu_n_, 1.0);
+  Vector<double> mu_s(prior_.A());
+  mu_s.AddMatVec(1.0, prior_.B(), kNoTrans, prior_.MuN(), 1.0);
+  sil_mean.CopyFromVec(prior_.MuN());
+  speech_mean.CopyFromVec(mu_s);
   for (int32 i = 0; i < num_rows; ++i) {
     noise_vectors->CopyRowFromVec(noise_vec, i);
   }
 }
 
-void OnlineNoiseVector::UpdateVector(
-    SubMatrix<BaseFloat> &feats,
-    std::vector<bool> &silence_decisions) {
-  // We first compute the sufficient statistics for the new
-  // chunk of data (i.e., for which we have silence decisions
-  // in silence_frames. We need, for both speech and noise
-  // frames, the number of frames, sum of all frames, and
-  // the variance of all frames.
-  int32 dim = dim_/2;
-  Vector<BaseFloat> cur_frame(dim);
-
-  for (int32 i = 0; i < feats.NumRows(); ++i) {
-    Vector<BaseFloat> cur_vec(dim);
-    cur_vec.CopyFromVec(feats.Row(i));
-    if (silence_decisions[i] == true) {
-      // This is a silence frame
-      num_noise_++;
-      noise_sum_.AddVec(1.0, cur_vec);
-      noise_var_.AddVecVec(1.0, cur_vec, cur_vec);  
+// Adds the sum and the scatter (sum of outer products) of the selected
+// rows of "feats" to "sum" and "scatter". The rows are gathered straight
+// into a contiguous double-precision block (the first rows of "block",
+// which is only reallocated when it grows), so that this is one
+// AddRowSumMat() and one SymAddMat2() call, rather than one rank-1
+// update per frame.
+static void AccumulateScatter(const MatrixBase<BaseFloat> &feats,
+                              const std::vector<int32> &rows,
+                              Matrix<double> *block,
+                              VectorBase<double> *sum,
+                              MatrixBase<double> *scatter) {
+  int32 num_rows = rows.size(), dim = feats.NumCols();
+  if (num_rows == 0)
+    return;
+  if (block->NumRows() < num_rows || block->NumCols() != dim)
+    block->Resize(std::max(num_rows, block->NumRows()), dim, kUndefined);
+  SubMatrix<double> rows_block(block->RowRange(0, num_rows));
+  if (num_rows == feats.NumRows()) {
+    rows_block.CopyFromMat(feats);
+  } else {
+    for (int32 i = 0; i < num_rows; i++)
+      rows_block.Row(i).CopyFromVec(feats.Row(rows[i]));
+  }
+  sum->AddRowSumMat(1.0, rows_block, 1.0);
+  scatter->SymAddMat2(1.0, rows_block, kTrans, 1.0);
+  // SymAddMat2() only updates the lower triangle.
+  scatter->CopyLowerToUpper();
+}
+
+// Makes sure "vec" has at least "dim" elements. It is only reallocated
+// when it grows, so the callers use its first "dim" elements.
+static void ReserveVector(int32 dim, Vector<BaseFloat> *vec) {
+  if (vec->Dim() < dim)
+    vec->Resize(dim, kUndefined);
+}
+
+// The masked sums are formed in float over blocks of at most this many
+// rows (about one chunk) before they are added to the double-precision
+// accumulators, so that a call on a whole utterance is as accurate as
+// calls on each of its chunks.
+static const int32 kMaskedSumBlockRows = 128;
+
+// Adds the sum of the rows of "feats" selected by the 0/1 weights in
+// "mask" to "sum"; "all_rows" is true if they are all selected. The sum
+// of each block of kMaskedSumBlockRows rows is formed in float in
+// "block_sum".
+static void AccumulateMaskedSum(const MatrixBase<BaseFloat> &feats,
+                                const VectorBase<BaseFloat> &mask,
+                                bool all_rows,
+                                Vector<BaseFloat> *block_sum,
+                                VectorBase<double> *sum) {
+  int32 num_rows = feats.NumRows(), dim = feats.NumCols();
+  if (block_sum->Dim() != dim)
+    block_sum->Resize(dim, kUndefined);
+  for (int32 start = 0; start < num_rows; start += kMaskedSumBlockRows) {
+    int32 this_num_rows = std::min(kMaskedSumBlockRows, num_rows - start);
+    SubMatrix<BaseFloat> block(feats, start, this_num_rows, 0, dim);
+    if (all_rows)
+      block_sum->AddRowSumMat(1.0, block, 0.0);
+    else
+      block_sum->AddMatVec(1.0, block, kTrans,
+                           mask.Range(start, this_num_rows), 0.0);
+    sum->AddVec(1.0, *block_sum);
+  }
+}
+
+void AccumulateSpeechNoiseStats(const MatrixBase<BaseFloat> &feats,
+                                const std::vector<bool> &silence_decisions,
+                                int32 offset,
+                                VectorBase<double> *speech_sum,
+                                VectorBase<double> *noise_sum,
+                                MatrixBase<double> *speech_scatter,
+                                MatrixBase<double> *noise_scatter,
+                                int32 *num_speech,
+                                int32 *num_noise,
+                                SpeechNoiseStatsWorkspace *workspace) {
+  int32 num_rows = feats.NumRows(), dim = feats.NumCols();
+  KALDI_ASSERT(offset >= 0 && offset + num_rows <=
+               static_cast<int32>(silence_decisions.size()) &&
+               speech_sum->Dim() == dim && noise_sum->Dim() == dim);
+  if (num_rows == 0)
+    return;
+  SpeechNoiseStatsWorkspace local_workspace;
+  if (workspace == NULL)
+    workspace = &local_workspace;
+  // The rows of a class are listed only if its scatter is needed, and its
+  // mask is only filled in otherwise.
+  bool speech_rows = (speech_scatter != NULL),
+      noise_rows = (noise_scatter != NULL);
+  workspace->speech_rows.clear();
+  workspace->noise_rows.clear();
+  if (speech_rows)
+    workspace->speech_rows.reserve(num_rows);
+  if (noise_rows)
+    workspace->noise_rows.reserve(num_rows);
+  ReserveVector(num_rows, &(workspace->speech_mask));
+  ReserveVector(num_rows, &(workspace->noise_mask));
+  SubVector<BaseFloat> speech_mask(workspace->speech_mask, 0, num_rows),
+      noise_mask(workspace->noise_mask, 0, num_rows);
+  int32 this_num_speech = 0;
+  for (int32 i = 0; i < num_rows; i++) {
+    bool silence = silence_decisions[offset + i];
+    this_num_speech += (silence ? 0 : 1);
+    if (silence) {
+      if (noise_rows)
+        workspace->noise_rows.push_back(i);
     } else {
-      // This is a speech frame
-      num_speech_++;
-      speech_sum_.AddVec(1.0, cur_vec);
-      speech_var_.AddVecVec(1.0, cur_vec, cur_vec);
+      if (speech_rows)
+        workspace->speech_rows.push_back(i);
     }
+    if (!speech_rows)
+      speech_mask(i) = (silence ? 0.0 : 1.0);
+    if (!noise_rows)
+      noise_mask(i) = (silence ? 1.0 : 0.0);
   }
+  int32 this_num_noise = num_rows - this_num_speech;
+  if (speech_rows)
+    AccumulateScatter(feats, workspace->speech_rows, &(workspace->block),
+                      speech_sum, speech_scatter);
+  else if (this_num_speech > 0)
+    AccumulateMaskedSum(feats, speech_mask, this_num_noise == 0,
+                        &(workspace->block_sum), speech_sum);
+  if (noise_rows)
+    AccumulateScatter(feats, workspace->noise_rows, &(workspace->block),
+                      noise_sum, noise_scatter);
+  else if (this_num_noise > 0)
+    AccumulateMaskedSum(feats, noise_mask, this_num_speech == 0,
+                        &(workspace->block_sum), noise_sum);
+  *num_speech += this_num_speech;
+  *num_noise += this_num_noise;
+}
 
-  // See paper for the math for this estimation method
-  Matrix<BaseFloat> K(2*dim, 2*dim);
-  Vector<BaseFloat> Q(2*dim);
-  
-  // Computing the matrix K
-  SubMatrix<BaseFloat> K_11(K, 0, dim, 0, dim), K_12(K, 0, dim, dim, dim),
-    K_21(K, dim, dim, 0, dim), K_22(K, dim, dim, dim, dim);
-  K_11.AddMat(1.0 + prior_.r_s_*num_speech_, prior_.Lambda_s_);
-  K_12.AddMatMat(-1.0, prior_.Lambda_s_, kNoTrans, prior_.B_, kNoTrans, 0);
-  K_21.AddMatMat(-1.0, prior_.B_, kTrans, prior_.Lambda_s_, kNoTrans, 0);
-  K_22.AddMat(1.0 + prior_.r_n_*num_noise_, prior_.Lambda_n_);
-  {
-    Matrix<BaseFloat> temp(dim, dim);
-    temp.AddMatMat(1.0, prior_.B_, kTrans, prior_.Lambda_s_, kNoTrans, 0);
-    K_22.AddMatMat(1.0, temp, kNoTrans, prior_.B_, kNoTrans, 1);
+void OnlineNoiseVector::AccumulateStats(
+    const MatrixBase<BaseFloat> &feats,
+    const std::vector<bool> &silence_decisions,
+    int32 offset) {
+  // We compute the sufficient statistics for the new
+  // chunk of data (i.e., for which we have silence decisions
+  // in silence_frames. We need, for both speech and noise
+  // frames, the number of frames, sum of all frames, and
+  // the variance of all frames (except in MLE mode, where the
+  // sums and counts are enough).
+  bool mle = IsMle();
+  int32 num_speech = 0, num_noise = 0;
+  AccumulateSpeechNoiseStats(feats, silence_decisions, offset,
+                             &speech_sum_, &noise_sum_,
+                             mle ? NULL : &speech_var_,
+                             mle ? NULL : &noise_var_,
+                             &num_speech, &num_noise, &stats_workspace_);
+  num_speech_ += num_speech;
+  num_noise_ += num_noise;
+}
+
+void OnlineNoiseVector::UpdateVector() {
+  ComputeVector(num_speech_, num_noise_, speech_sum_, noise_sum_,
+                r_s_, r_n_, &current_vector_);
+}
+
+void OnlineNoiseVector::UpdateVectorsBatch(
+    const std::vector<OnlineNoiseVector*> &batch,
+    BatchWorkspace *workspace) {
+  int32 num_rows = batch.size();
+  if (num_rows == 0)
+    return;
+  const OnlineNoisePriorFactors &prior = batch[0]->prior_;
+  KALDI_ASSERT(workspace->x.NumRows() >= num_rows);
+  // Row i holds the terms of ComputeVector() for batch[i]; the noise
+  // terms are computed with one matrix-matrix product, whose row i is
+  // (Lambda_n temp_i)^T as in ComputeVector().
+  SubMatrix<double> speech_terms(workspace->speech_terms, 0, num_rows,
+                                 0, workspace->speech_terms.NumCols()),
+      noise_means(workspace->noise_means, 0, num_rows,
+                  0, workspace->noise_means.NumCols()),
+      noise_terms(workspace->noise_terms, 0, num_rows,
+                  0, workspace->noise_terms.NumCols()),
+      x(workspace->x, 0, num_rows, 0, workspace->x.NumCols());
+  SubVector<double> speech_scales(workspace->speech_scales, 0, num_rows),
+      noise_scales(workspace->noise_scales, 0, num_rows);
+  for (int32 i = 0; i < num_rows; i++) {
+    const OnlineNoiseVector &extractor = *(batch[i]);
+    SubVector<double> speech_term(speech_terms, i),
+        noise_mean(noise_means, i);
+    speech_term.CopyFromVec(prior.A());
+    speech_term.AddVec(extractor.r_s_, extractor.speech_sum_);
+    noise_mean.CopyFromVec(prior.MuN());
+    noise_mean.AddVec(extractor.r_n_, extractor.noise_sum_);
+    speech_scales(i) = 1.0 + extractor.r_s_ * extractor.num_speech_;
+    noise_scales(i) = 1.0 + extractor.r_n_ * extractor.num_noise_;
   }
+  noise_terms.CopyRowsFromVec(prior.BtLambdaSA());
+  noise_terms.AddMatMat(1.0, noise_means, kNoTrans, prior.LambdaN(),
+                        kTrans, 1.0);
+  prior.SolvePosteriorMeans(speech_scales, noise_scales, speech_terms,
+                            noise_terms, &x);
+  for (int32 i = 0; i < num_rows; i++)
+    batch[i]->current_vector_.CopyFromVec(x.Row(i));
+}
 
-  // Computing the vector Q
-  SubVector<BaseFloat> Q_1(Q, 0, dim), Q_2(Q, dim, dim);
-  {
-    Vector<BaseFloat> temp = prior_.a_;
-    temp.AddVec(prior_.r_s_, speech_sum_);
-    Q_1.AddMatVec(1.0, prior_.Lambda_s_, kNoTrans, temp, 0.0);
+void OnlineNoiseVector::ComputeVector(double num_speech, double num_noise,
+                                      const VectorBase<double> &speech_sum,
+                                      const VectorBase<double> &noise_sum,
+                                      double r_s, double r_n,
+                                      VectorBase<BaseFloat> *vector) const {
+  int32 dim = dim_/2;
+  if (IsMle()) {
+    // The MLE estimates are just the means of the speech and silence
+    // frames seen so far (zero if there were none).
+    SubVector<BaseFloat> speech_mean(*vector, 0, dim),
+        noise_mean(*vector, dim, dim);
+    speech_mean.SetZero();
+    noise_mean.SetZero();
+    if (num_speech > 0)
+      speech_mean.AddVec(1.0 / num_speech, speech_sum);
+    if (num_noise > 0)
+      noise_mean.AddVec(1.0 / num_noise, noise_sum);
+    return;
   }
+  // See paper for the math for this estimation method. The posterior
+  // mean solves K x = Q, with
+  // K = [ (1 + r_s N_s) Lambda_s    -Lambda_s B                        ]
+  //     [ -B^T Lambda_s             (1 + r_n N_n) Lambda_n + B^T Lambda_s B ]
+  // Since K only changes through the two scalars on the diagonal, the
+  // solve is done by the prior using precomputed factors (see
+  // OnlineNoisePrior::SolvePosteriorMean()), so we only need Q here.
+  // Q_1 = Lambda_s (a + r_s speech_sum), and we pass Lambda_s^{-1} Q_1.
+  Vector<double> speech_term(prior_.A());
+  speech_term.AddVec(r_s, speech_sum);
+
+  // Computing the vector
+  // Q_2 = Lambda_n (mu_n + r_n noise_sum) + B^T Lambda_s a.
+  Vector<double> noise_term(dim);
   {
-    Vector<BaseFloat> temp = prior_.mu_n_;
-    temp.AddVec(prior_.r_n_, noise_sum_);
-    Q_2.AddMatVec(1.0, prior_.Lambda_n_, kNoTrans, temp, 0.0);
-    temp.AddMatVec(1.0, prior_.Lambda_s_, kNoTrans, prior_.a_, 0.0);
-    Q_2.AddMatVec(1.0, prior_.B_, kTrans, temp, 1.0);
+    Vector<double> temp(prior_.MuN());
+    temp.AddVec(r_n, noise_sum);
+    noise_term.AddMatVec(1.0, prior_.LambdaN(), kNoTrans, temp, 0.0);
+    noise_term.AddVec(1.0, prior_.BtLambdaSA());
   }
 
   // Compute the nvector from K and Q
-  K.Invert();
-  current_vector_.AddMatVec(1.0, K, kNoTrans, Q, 0.0);
+  Vector<double> x(2*dim);
+  prior_.SolvePosteriorMean(1.0 + r_s*num_speech,
+                            1.0 + r_n*num_noise,
+                            speech_term, noise_term, &x);
+  vector->CopyFromVec(x);
 }
 
-void OnlineNoiseVector::UpdateScalingParams(
-    SubMatrix<BaseFloat> &feats,
-    std::vector<bool> &silence_decisions) {
+void OnlineNoiseVector::UpdateScalingParams() {
   int32 dim = dim_/2;
-  
-  Vector<BaseFloat> cur_frame(dim);
-  
+
   if (num_speech_ > 0) { 
-    prior_.r_s_ = (dim * num_speech_) / 
-      TraceMatMat(prior_.Lambda_s_, speech_var_);
+    r_s_ = (dim * num_speech_) / 
+      TraceMatMat(prior_.LambdaS(), speech_var_);
   }
   if (num_noise_ > 0) {
-  prior_.r_n_ = (dim * num_noise_) / 
-    TraceMatMat(prior_.Lambda_n_, noise_var_);
+  r_n_ = (dim * num_noise_) / 
+    TraceMatMat(prior_.LambdaN(), noise_var_);
   }
 }
 
+void OnlineNoiseVector::GetAdaptationState(
+    OnlineNoiseVectorAdaptationState *adaptation_state) const {
+  adaptation_state->num_speech = num_speech_;
+  adaptation_state->num_noise = num_noise_;
+  adaptation_state->speech_sum = speech_sum_;
+  adaptation_state->noise_sum = noise_sum_;
+  adaptation_state->speech_var = speech_var_;
+  adaptation_state->noise_var = noise_var_;
+  adaptation_state->r_s = r_s_;
+  adaptation_state->r_n = r_n_;
+  adaptation_state->current_vector = current_vector_;
+}
+
+void OnlineNoiseVector::SetAdaptationState(
+    const OnlineNoiseVectorAdaptationState &adaptation_state) {
+  int32 dim = dim_/2;
+  if (adaptation_state.speech_sum.Dim() != dim ||
+      adaptation_state.noise_sum.Dim() != dim ||
+      adaptation_state.speech_var.NumRows() != dim ||
+      adaptation_state.noise_var.NumRows() != dim ||
+      adaptation_state.current_vector.Dim() != dim_)
+    KALDI_ERR << "Adaptation state has wrong dimension, expected "
+              << dim_ << " for the noise vectors.";
+  num_speech_ = adaptation_state.num_speech;
+  num_noise_ = adaptation_state.num_noise;
+  speech_sum_.CopyFromVec(adaptation_state.speech_sum);
+  noise_sum_.CopyFromVec(adaptation_state.noise_sum);
+  speech_var_.CopyFromMat(adaptation_state.speech_var);
+  noise_var_.CopyFromMat(adaptation_state.noise_var);
+  r_s_ = adaptation_state.r_s;
+  r_n_ = adaptation_state.r_n;
+  current_vector_.CopyFromVec(adaptation_state.current_vector);
+}
+
+void OnlineNoiseVectorAdaptationState::Write(std::ostream &os,
+                                             bool binary) const {
+  WriteToken(os, binary, "<OnlineNoiseVectorAdaptationState>");
+  WriteToken(os, binary, "<NumSpeech>");
+  WriteBasicType(os, binary, num_speech);
+  WriteToken(os, binary, "<NumNoise>");
+  WriteBasicType(os, binary, num_noise);
+  WriteToken(os, binary, "<SpeechSum>");
+  speech_sum.Write(os, binary);
+  WriteToken(os, binary, "<NoiseSum>");
+  noise_sum.Write(os, binary);
+  WriteToken(os, binary, "<SpeechVar>");
+  speech_var.Write(os, binary);
+  WriteToken(os, binary, "<NoiseVar>");
+  noise_var.Write(os, binary);
+  WriteToken(os, binary, "<ScaleSpeech>");
+  WriteBasicType(os, binary, r_s);
+  WriteToken(os, binary, "<ScaleNoise>");
+  WriteBasicType(os, binary, r_n);
+  WriteToken(os, binary, "<CurrentVector>");
+  current_vector.Write(os, binary);
+  WriteToken(os, binary, "</OnlineNoiseVectorAdaptationState>");
+}
+
+void OnlineNoiseVectorAdaptationState::Read(std::istream &is, bool binary) {
+  ExpectToken(is, binary, "<OnlineNoiseVectorAdaptationState>");
+  ExpectToken(is, binary, "<NumSpeech>");
+  ReadBasicType(is, binary, &num_speech);
+  ExpectToken(is, binary, "<NumNoise>");
+  ReadBasicType(is, binary, &num_noise);
+  ExpectToken(is, binary, "<SpeechSum>");
+  speech_sum.Read(is, binary);
+  ExpectToken(is, binary, "<NoiseSum>");
+  noise_sum.Read(is, binary);
+  ExpectToken(is, binary, "<SpeechVar>");
+  speech_var.Read(is, binary);
+  ExpectToken(is, binary, "<NoiseVar>");
+  noise_var.Read(is, binary);
+  ExpectToken(is, binary, "<ScaleSpeech>");
+  ReadBasicType(is, binary, &r_s);
+  ExpectToken(is, binary, "<ScaleNoise>");
+  ReadBasicType(is, binary, &r_n);
+  ExpectToken(is, binary, "<CurrentVector>");
+  current_vector.Read(is, binary);
+  ExpectToken(is, binary, "</OnlineNoiseVectorAdaptationState>");
+}
+
+NoiseVectorStageTimer::NoiseVectorStageTimer(bool enabled):
+    enabled_(enabled), cpu_start_(enabled ? ThreadCpuSeconds() : 0.0) { }
+
+void NoiseVectorStageTimer::Reset() {
+  timer_.Reset();
+  if (enabled_)
+    cpu_start_ = ThreadCpuSeconds();
+}
+
+double NoiseVectorStageTimer::Stop(NoiseVectorStageTime *time) const {
+  double elapsed = timer_.Elapsed();
+  if (time != NULL) {
+    time->wall_seconds += elapsed;
+    if (enabled_)
+      time->cpu_seconds += ThreadCpuSeconds() - cpu_start_;
+  }
+  return elapsed;
+}
+
+double NoiseVectorStageTimer::ThreadCpuSeconds() {
+  struct timespec ts;
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+    return 0.0;
+  return ts.tv_sec + 1.0e-09 * ts.tv_nsec;
+}
+
 OnlineNoiseVector::~OnlineNoiseVector() {
   // Delete objects owned here.
 }
@@ -28,31 +28,116 @@
 #include "matrix/matrix-lib.h"
 #include "util/common-utils.h"
 #include "base/kaldi-error.h"
+#include "base/timer.h"
 
 namespace kaldi {
 
 // forward declaration
 class OnlineNoiseVector;
 
+/// The parts of a noise prior that OnlineNoiseVector needs, in double
+/// precision, including the factorization used by the solve. This is a
+/// read-only view of memory owned elsewhere: by an OnlineNoisePrior (see
+/// OnlineNoisePrior::Factors()) or by a MappedOnlineNoisePrior. It is
+/// cheap to copy, and the owner must outlive it. A default-constructed
+/// object is empty (FeatDim() == 0).
+class OnlineNoisePriorFactors {
+ public:
+  OnlineNoisePriorFactors();
+
+  /// The feature dimension d; the noise vectors have dimension 2 * d.
+  int32 FeatDim() const { return dim_; }
+  double ScaleSpeech() const { return r_s_; }  // r_s
+  double ScaleNoise() const { return r_n_; }  // r_n
+
+  SubVector<double> MuN() const { return Vec(mu_n_); }
+  SubVector<double> A() const { return Vec(a_); }
+  SubMatrix<double> B() const { return Mat(B_); }
+  SubMatrix<double> LambdaN() const { return Mat(Lambda_n_); }
+  SubMatrix<double> LambdaS() const { return Mat(Lambda_s_); }
+  SubMatrix<double> BtLambdaS() const { return Mat(BtLambda_s_); }
+  /// B^T Lambda_s a, the constant part of Q_2.
+  SubVector<double> BtLambdaSA() const { return Vec(BtLambda_s_a_); }
+
+  /// Solves K x = Q for the posterior mean x = [s; n] (see
+  /// OnlineNoiseVector::UpdateVector() for K and Q). K only depends on
+  /// the data through speech_scale = 1 + r_s * num_speech and
+  /// noise_scale = 1 + r_n * num_noise, so using the precomputed
+  /// factorization this costs O(d^2) instead of the O(d^3) of inverting
+  /// K. "speech_term" is Lambda_s^{-1} Q_1 and "noise_term" is Q_2. The
+  /// result agrees with the explicit inverse of K to within about 1e-5
+  /// relative error (limited by float precision of the latter).
+  void SolvePosteriorMean(double speech_scale, double noise_scale,
+                          const VectorBase<double> &speech_term,
+                          const VectorBase<double> &noise_term,
+                          VectorBase<double> *x) const;
+
+  /// As SolvePosteriorMean(), but for several problems at once: row i of
+  /// "speech_terms", "noise_terms" and "x" and element i of the scales
+  /// belong to problem i. The products with the prior factors are done
+  /// as matrix-matrix products, which is much faster than a loop over
+  /// SolvePosteriorMean() for more than a few rows.
+  void SolvePosteriorMeans(const VectorBase<double> &speech_scales,
+                           const VectorBase<double> &noise_scales,
+                           const MatrixBase<double> &speech_terms,
+                           const MatrixBase<double> &noise_terms,
+                           MatrixBase<double> *x) const;
+
+ private:
+  friend class OnlineNoisePrior;
+  friend class MappedOnlineNoisePrior;
+
+  SubVector<double> Vec(const double *data) const {
+    return SubVector<double>(const_cast<double*>(data), dim_);
+  }
+  SubMatrix<double> Mat(const double *data) const {
+    return SubMatrix<double>(const_cast<double*>(data), dim_, dim_, stride_);
+  }
+
+  int32 dim_;
+  int32 stride_;  // Row stride of the matrices, in elements.
+  double r_s_;
+  double r_n_;
+  const double *mu_n_;
+  const double *a_;
+  const double *B_;
+  const double *Lambda_n_;
+  const double *Lambda_s_;
+  const double *BtLambda_s_;
+  const double *BtLambda_s_a_;
+  // transform_ (W) simultaneously diagonalizes Lambda_n and
+  // B^T Lambda_s B, i.e. W Lambda_n W^T = I and
+  // W B^T Lambda_s B W^T = diag(psi_).
+  const double *transform_;
+  const double *psi_;
+};
+
 class OnlineNoisePrior {
- friend class OnlineNoiseVector;
 
  public:
   OnlineNoisePrior() { }
 
-  explicit OnlineNoisePrior(const OnlineNoisePrior &other):
+  OnlineNoisePrior(const OnlineNoisePrior &other):
     mu_n_(other.mu_n_),
     a_(other.a_),
     B_(other.B_),
     Lambda_n_(other.Lambda_n_),
     Lambda_s_(other.Lambda_s_),
     r_s_(other.r_s_),
-    r_n_(other.r_n_) {
+    r_n_(other.r_n_),
+    mu_n_double_(other.mu_n_double_),
+    a_double_(other.a_double_),
+    B_double_(other.B_double_),
+    Lambda_n_double_(other.Lambda_n_double_),
+    Lambda_s_double_(other.Lambda_s_double_),
+    BtLambda_s_(other.BtLambda_s_),
+    BtLambda_s_a_(other.BtLambda_s_a_),
+    transform_(other.transform_),
+    psi_(other.psi_) {
   };
 
-  OnlineNoisePrior &operator = (const OnlineNoisePrior &other) {
-    return *this;
-  }
+  /// Copies all the parameters, including the derived ones.
+  OnlineNoisePrior &operator = (const OnlineNoisePrior &other);
 
   int32 Dim() const;
 
@@ -72,7 +157,28 @@ class OnlineNoisePrior {
   void Write(std::ostream &os, bool binary) const;
   void Read(std::istream &is, bool binary);
 
+  /// Writes the prior in the memory-mappable format read by
+  /// MappedOnlineNoisePrior, which includes the derived variables.
+  void WriteMapped(const std::string &wxfilename) const;
+
+  /// Returns a view of the parameters needed by OnlineNoiseVector; it
+  /// refers to this object, which must outlive it.
+  OnlineNoisePriorFactors Factors() const;
+
+  /// See OnlineNoisePriorFactors::SolvePosteriorMean().
+  void SolvePosteriorMean(double speech_scale, double noise_scale,
+                          const VectorBase<double> &speech_term,
+                          const VectorBase<double> &noise_term,
+                          VectorBase<double> *x) const {
+    Factors().SolvePosteriorMean(speech_scale, noise_scale, speech_term,
+                                 noise_term, x);
+  }
+
  protected:
+  // Computes the derived variables below from the parameters
+  // above. Called from Read() and EstimatePriorParameters().
+  void ComputeDerivedVars();
+
   Vector<BaseFloat> mu_n_;  // mean of noise vectors.
   Vector<BaseFloat> a_;  // shift factor for mean of speech vectors.
   Matrix<BaseFloat> B_;  // scale factor for mean of speech vectors.
@@ -81,73 +187,513 @@ class OnlineNoisePrior {
   double r_s_; // scaling factor for speech.
   double r_n_; // scaling factor for noise.
 
+  // Derived variables; these are not written to disk (except by
+  // WriteMapped()).
+  Vector<double> mu_n_double_;  // mu_n_ in double precision.
+  Vector<double> a_double_;  // a_ in double precision.
+  Matrix<double> B_double_;  // B_ in double precision.
+  Matrix<double> Lambda_n_double_;  // Lambda_n_ in double precision.
+  Matrix<double> Lambda_s_double_;  // Lambda_s_ in double precision.
+  Matrix<double> BtLambda_s_;  // B^T Lambda_s.
+  Vector<double> BtLambda_s_a_;  // B^T Lambda_s a.
+  // See OnlineNoisePriorFactors.
+  Matrix<double> transform_;
+  Vector<double> psi_;
+};
+
+/// A noise prior in the format written by OnlineNoisePrior::WriteMapped():
+/// a versioned header followed by the parameters and the precomputed
+/// factorization in double precision, each array 64-byte aligned, in
+/// native byte order. Open() maps the file read-only, so loading copies
+/// nothing, and all the processes that use the same file share its pages
+/// through the page cache. This suits many short-lived workers.
+class MappedOnlineNoisePrior {
+ public:
+  MappedOnlineNoisePrior(): data_(NULL), size_(0) { }
+
+  /// Maps "filename", which must be a regular file. Dies with KALDI_ERR
+  /// if it cannot be mapped or is not a valid mapped prior.
+  void Open(const std::string &filename);
+
+  /// Returns true if "rxfilename" is a regular file that starts like a
+  /// mapped prior (it does not validate the rest).
+  static bool IsMappedPriorFile(const std::string &rxfilename);
+
+  /// The factors refer to the mapping, so this object must outlive them.
+  const OnlineNoisePriorFactors &Factors() const { return factors_; }
+
+  ~MappedOnlineNoisePrior();
+
+ private:
+  void *data_;
+  size_t size_;
+  OnlineNoisePriorFactors factors_;
+  KALDI_DISALLOW_COPY_AND_ASSIGN(MappedOnlineNoisePrior);
+};
+
+/// This class accumulates the mean and covariance of the training noise
+/// vectors that OnlineNoisePrior::EstimatePriorParameters() needs, in a
+/// single pass and in constant memory. It keeps the count, the mean and
+/// the scatter around the mean in double precision, and updates them with
+/// Welford's method, which is numerically stable even for large corpora.
+/// Stats accumulated on different parts of the data can be written to
+/// disk and merged (see acc-noise-prior-stats, sum-noise-prior-stats and
+/// est-noise-prior).
+class OnlineNoisePriorStats {
+ public:
+  OnlineNoisePriorStats() : count_(0.0) { }
+
+  explicit OnlineNoisePriorStats(int32 dim);
+
+  int32 Dim() const { return mean_.Dim(); }
+
+  double Count() const { return count_; }
+
+  /// Adds one noise vector to the statistics.
+  void AccStats(const VectorBase<BaseFloat> &noise_vector);
+
+  /// Adds the statistics from another object, e.g. accumulated on
+  /// another part of the data.
+  void Add(const OnlineNoisePriorStats &other);
+
+  /// Outputs the mean and the (unbiased) covariance of the vectors seen
+  /// so far. Requires at least two vectors.
+  void GetMeanAndCovariance(Vector<BaseFloat> *mean,
+                            SpMatrix<BaseFloat> *covariance) const;
+
+  void Write(std::ostream &os, bool binary) const;
+  /// If "add" is true, the stats read are added to the current ones.
+  void Read(std::istream &is, bool binary, bool add = false);
+
+ private:
+  double count_;
+  Vector<double> mean_;
+  SpMatrix<double> scatter_;  // sum of (x - mean)(x - mean)^T.
+};
+
+/// Adds the noise vectors in the table "noise_vec_rspecifier" to "stats",
+/// which is initialized from the first vector if it is empty. Vectors
+/// whose dimension does not match, and (unless "skip_dup_check") vectors
+/// whose key was already seen, are skipped with a warning and counted in
+/// "num_err". Returns the number of vectors accumulated. This is shared
+/// by compute-noise-prior and acc-noise-prior-stats.
+int32 AccumulateNoisePriorStats(const std::string &noise_vec_rspecifier,
+                                bool skip_dup_check,
+                                OnlineNoisePriorStats *stats,
+                                int32 *num_err);
+
+/// This struct holds the adaptation state of OnlineNoiseVector, i.e. the
+/// statistics accumulated so far, the adapted scaling factors r_s and r_n
+/// and the current estimate. It can be used to carry the state over
+/// between utterances of the same speaker, and written to disk so that a
+/// long session can be resumed without going over the earlier audio
+/// again (cf. OnlineIvectorExtractorAdaptationState).
+struct OnlineNoiseVectorAdaptationState {
+  // The frame counts; these are not integers if a forgetting factor is
+  // used.
+  double num_speech;
+  double num_noise;
+  Vector<double> speech_sum;
+  Vector<double> noise_sum;
+  Matrix<double> speech_var;
+  Matrix<double> noise_var;
+  double r_s;
+  double r_n;
+  Vector<BaseFloat> current_vector;
+
+  OnlineNoiseVectorAdaptationState(): num_speech(0.0), num_noise(0.0),
+                                      r_s(0.0), r_n(0.0) { }
+
+  void Write(std::ostream &os, bool binary) const;
+  void Read(std::istream &is, bool binary);
+};
+
+/// Temporary storage for AccumulateSpeechNoiseStats(). The buffers only
+/// grow, so a caller that keeps one across calls (e.g. one per chunk)
+/// does not allocate once they have reached the largest block size.
+struct SpeechNoiseStatsWorkspace {
+  Vector<BaseFloat> speech_mask;
+  Vector<BaseFloat> noise_mask;
+  Vector<BaseFloat> block_sum;
+  std::vector<int32> speech_rows;
+  std::vector<int32> noise_rows;
+  Matrix<double> block;  // The gathered rows of one class.
+};
+
+/// Adds the statistics of the speech and the silence frames of "feats"
+/// to the accumulators; silence_decisions[offset + i] is the decision
+/// for row i (true for silence). The scatters (sums of outer products)
+/// may be NULL if they are not needed. For a class whose scatter is
+/// needed, its rows are gathered once and give both the sum and the
+/// scatter (the latter with one symmetric rank-k update); otherwise its
+/// sum is computed with one matrix-vector product per block of up to 128
+/// rows, weighted by a 0/1 mask. Either way there is no per-frame
+/// branching or per-frame AddVec() call. The accumulators are in double
+/// precision, so that they stay accurate over many hours of data; the
+/// float partial sums of the masked path never cover more than one
+/// block, so this holds for whole utterances (as in the offline
+/// binaries) as well as for chunks. The frame counts are
+/// added to "num_speech" and "num_noise". If "workspace" is NULL,
+/// temporary storage is allocated for this call. This is shared by
+/// OnlineNoiseVector and the offline extraction binaries.
+void AccumulateSpeechNoiseStats(const MatrixBase<BaseFloat> &feats,
+                                const std::vector<bool> &silence_decisions,
+                                int32 offset,
+                                VectorBase<double> *speech_sum,
+                                VectorBase<double> *noise_sum,
+                                MatrixBase<double> *speech_scatter,
+                                MatrixBase<double> *noise_scatter,
+                                int32 *num_speech,
+                                int32 *num_noise,
+                                SpeechNoiseStatsWorkspace *workspace = NULL);
+
+/// Wall-clock and CPU time spent in one stage of the noise vector
+/// computation, for profiling. The CPU time is that of the thread that
+/// ran the stage.
+struct NoiseVectorStageTime {
+  double wall_seconds;
+  double cpu_seconds;
+
+  NoiseVectorStageTime(): wall_seconds(0.0), cpu_seconds(0.0) { }
+
+  void Add(const NoiseVectorStageTime &other) {
+    wall_seconds += other.wall_seconds;
+    cpu_seconds += other.cpu_seconds;
+  }
+};
+
+/// Times a stage from its construction (or Reset()) until Stop(), which
+/// adds the elapsed times to "time" (if "time" is not NULL). If
+/// "enabled" is false, the CPU clock (a system call) is not read.
+class NoiseVectorStageTimer {
+ public:
+  explicit NoiseVectorStageTimer(bool enabled = true);
+
+  /// Returns the wall-clock time elapsed, in seconds.
+  double Stop(NoiseVectorStageTime *time) const;
+
+  /// Restarts the timer.
+  void Reset();
+
+  /// Returns the CPU time used so far by the calling thread, in seconds.
+  static double ThreadCpuSeconds();
+
+ private:
+  bool enabled_;
+  Timer timer_;
+  double cpu_start_;
+};
+
+/// The time spent by OnlineNoiseVector in each of its stages; see
+/// OnlineNoiseVector::SetTimingInfo().
+struct OnlineNoiseVectorTimingInfo {
+  NoiseVectorStageTime accumulate;  // AccumulateStats()
+  NoiseVectorStageTime solve;  // UpdateVector(), i.e. the K solve
+  NoiseVectorStageTime scale_update;  // UpdateScalingParams()
+
+  void Add(const OnlineNoiseVectorTimingInfo &other) {
+    accumulate.Add(other.accumulate);
+    solve.Add(other.solve);
+    scale_update.Add(other.scale_update);
+  }
 };
 
 /// This class is used to extract online noise vectors. It is
 /// initialized with an OnlineNoisePrior object and subsequently
 /// generates online noise vectors by taking feats for an input
-/// utterance and speech/silence targets.
+/// utterance and speech/silence targets. If it is initialized without
+/// a prior, it computes maximum likelihood (MLE) estimates instead,
+/// i.e. the running means of the speech and the silence frames seen
+/// so far; these only need the sums and counts, so each chunk costs
+/// O(d) per frame.
 
 class OnlineNoiseVector {
  public:
-  /// Constructor. It is initialized with an OnlineNoisePrior object.
+  /// Constructor. It is initialized with an OnlineNoisePrior object,
+  /// which is not copied: it must outlive this object, and may be
+  /// shared between several of them (e.g. in different threads).
   /// Ideally you would want to initalize this once for each speaker,
   /// so that the updated scaling parameters can be reused in
   /// all utterances of the speaker.
+  /// If "forgetting_factor" is less than 1.0, the statistics are scaled
+  /// by forgetting_factor^n at the end of each chunk of n frames, i.e.
+  /// each frame is weighted down exponentially with its age, with an
+  /// effective window of about 1 / (1 - forgetting_factor) frames. This
+  /// lets the estimate follow slowly changing noise conditions in long
+  /// streams; it costs O(d^2) per chunk and keeps no frame history.
   explicit OnlineNoiseVector(const OnlineNoisePrior &noise_prior, 
-                             const int32 period);
-
-  /// This function performs the actual noise vector computation, and
-  /// can be called from a binary.
-  void ExtractVectors(const Matrix<BaseFloat> &feats,
+                             const int32 period,
+                             BaseFloat forgetting_factor = 1.0);
+
+  /// As above, but from the factors of a prior, e.g. of a
+  /// MappedOnlineNoisePrior (which must outlive this object).
+  OnlineNoiseVector(const OnlineNoisePriorFactors &prior_factors,
+                    const int32 period,
+                    BaseFloat forgetting_factor = 1.0);
+
+  /// Constructor for MLE estimation (no prior). "feat_dim" is the
+  /// feature dimension; the noise vectors have dimension 2 * feat_dim.
+  OnlineNoiseVector(const int32 feat_dim, const int32 period,
+                    BaseFloat forgetting_factor = 1.0);
+
+  /// Returns true if this object computes MLE estimates (no prior).
+  bool IsMle() const { return prior_.FeatDim() == 0; }
+
+  /// This function performs the actual noise vector computation for a
+  /// whole utterance, and can be called from a binary. It is equivalent
+  /// to calling AcceptFrames() with all the frames followed by
+  /// InputFinished(), and it starts a new utterance (frame index 0)
+  /// each time it is called; the statistics carry over.
+  void ExtractVectors(const MatrixBase<BaseFloat> &feats,
                       const std::vector<bool> &silence_decisions,
                       Matrix<BaseFloat> *noise_vectors);
 
+  /// Does the same as ExtractVectors() on each element of "extractors"
+  /// with the corresponding features and decisions, but processes the
+  /// utterances' chunks in lockstep so that the posterior means of a
+  /// chunk are solved for all of them in one go (see
+  /// OnlineNoisePriorFactors::SolvePosteriorMeans()). The extractors must
+  /// be distinct and use the same prior factors and period; each keeps
+  /// its own statistics. This is for offline extraction of many
+  /// utterances; the results are the same as calling ExtractVectors()
+  /// separately. If timing, the solve time is added to the timing info of
+  /// extractors[0] only. In MLE mode there is nothing to share, and the
+  /// utterances are just processed in turn.
+  static void ExtractVectorsBatch(
+      const std::vector<OnlineNoiseVector*> &extractors,
+      const std::vector<const MatrixBase<BaseFloat>*> &feats,
+      const std::vector<const std::vector<bool>*> &silence_decisions,
+      std::vector<Matrix<BaseFloat> > *noise_vectors);
+
   /// This function just computes the noise vectors from the
   /// prior parameters since no silence decisions are provided.
+  /// In MLE mode the vectors are zero.
   void ExtractVectors(const Matrix<BaseFloat> &feats,
                       Matrix<BaseFloat> *noise_vectors);
 
+  /// Outputs the adaptation state (accumulated statistics and adapted
+  /// scaling factors), e.g. to write it to disk.
+  void GetAdaptationState(
+      OnlineNoiseVectorAdaptationState *adaptation_state) const;
+
+  /// Restores a state previously obtained from GetAdaptationState(),
+  /// from an object initialized with the same prior. Estimation then
+  /// continues as if the earlier data had been seen by this object.
+  void SetAdaptationState(
+      const OnlineNoiseVectorAdaptationState &adaptation_state);
+
+  /// If "timing_info" is not NULL, the time spent in each stage is
+  /// added to it from now on (it is not owned here). Timing is off by
+  /// default.
+  void SetTimingInfo(OnlineNoiseVectorTimingInfo *timing_info) {
+    timing_info_ = timing_info;
+  }
+
+  /// In low-latency mode, the counts and sums are also recorded after
+  /// every frame of the current chunk, so that GetFrameVector() can return
+  /// the estimate at any of its frames without waiting for the end of the
+  /// chunk. This costs O(d) time per frame and O(period * d) memory, which
+  /// does not grow with the length of the stream (the scatters are not
+  /// recorded; the scaling factors are still updated once per chunk). The
+  /// records of a chunk are overwritten by the next one, so a streaming
+  /// caller should query its frames before accepting frames past the
+  /// chunk's end (see also ExtractFrameVectors()). The per-frame estimates
+  /// use the same weighting of the frames as the vector at the end of the
+  /// chunk: with a forgetting factor, the statistics are scaled at chunk
+  /// boundaries only, and the frames of the current chunk all have weight
+  /// 1. It must be set before the first frame of an utterance is
+  /// accepted. Off by default.
+  void SetLowLatency(bool low_latency);
+
+  /// The following functions are the streaming interface, in the
+  /// style of OnlineFeatureInterface. AcceptFrames() may be called with
+  /// any number of frames at a time (e.g. 10ms pieces); the frames are
+  /// added to the statistics straight away, and a new vector is estimated
+  /// each time a chunk of period_ frames is complete, so nothing is
+  /// buffered. "silence_decisions" has one entry per row of "feats".
+  ///
+  /// A new object is ready for its first utterance. To stream another
+  /// utterance through the same object (e.g. the next utterance of the
+  /// speaker), call StartUtterance() first: it resets the frame index to
+  /// 0 and drops the vectors of the previous utterance, while the
+  /// statistics and scaling factors carry over, as with ExtractVectors().
+  /// If InputFinished() was not called for the previous utterance, it is
+  /// called here. "num_frames" is the length of the new utterance if
+  /// known, so that the storage for its vectors can be reserved;
+  /// otherwise 0.
+  void StartUtterance(int32 num_frames = 0);
+
+  void AcceptFrames(const MatrixBase<BaseFloat> &feats,
+                    const std::vector<bool> &silence_decisions);
+
+  /// Call this when no more frames will be given for this utterance; it
+  /// estimates a vector for the last, partial chunk (if any).
+  void InputFinished();
+
+  /// Returns the number of frames for which a vector is available. This
+  /// is a multiple of period_ until InputFinished() has been called.
+  int32 NumFramesReady() const;
+
+  bool IsLastFrame(int32 frame) const {
+    return input_finished_ && frame == num_frames_ - 1;
+  }
+
+  /// Returns the noise vector for frame "frame" (frame < NumFramesReady()),
+  /// i.e. the estimate at the end of the chunk that contains the frame.
+  void GetVector(int32 frame, VectorBase<BaseFloat> *vector) const;
+
+  /// Returns the number of frames accepted so far in this utterance.
+  int32 NumFramesAccepted() const { return num_frames_; }
+
+  /// Low-latency mode only (see SetLowLatency()): outputs the noise vector
+  /// estimated from the statistics up to and including frame "frame",
+  /// which must be in the chunk that contains the last frame accepted. It
+  /// is solved on demand from the recorded statistics, at O(d^2) cost; at
+  /// the last frame of a chunk it equals the vector returned by
+  /// GetVector().
+  void GetFrameVector(int32 frame, VectorBase<BaseFloat> *vector) const;
+
+  /// Low-latency mode only: like ExtractVectors(), but outputs one vector
+  /// per frame, as returned by GetFrameVector() for that frame. The time
+  /// spent on the per-frame solves is counted as solve time.
+  void ExtractFrameVectors(const MatrixBase<BaseFloat> &feats,
+                           const std::vector<bool> &silence_decisions,
+                           Matrix<BaseFloat> *frame_vectors);
+
+  int32 Dim() const { return dim_; }
+
   virtual ~OnlineNoiseVector();
 
  private:
 
+  // Accepts the rows of "feats", which must not cross a chunk boundary,
+  // without finishing the chunk. The decision for row i of "feats" is
+  // silence_decisions[offset + i].
+  void AcceptChunkFrames(const MatrixBase<BaseFloat> &feats,
+                         const std::vector<bool> &silence_decisions,
+                         int32 offset);
+
+  // Adds the speech and noise statistics for "feats" to the online
+  // statistic estimate. The decision for row i of "feats" is
+  // silence_decisions[offset + i].
+  void AccumulateStats(const MatrixBase<BaseFloat> &feats,
+                       const std::vector<bool> &silence_decisions,
+                       int32 offset);
+
+  // Records the counts and sums after each row of "feats", whose
+  // decisions start at silence_decisions[offset], in frame_stats_. Must
+  // be called before the rows are added to the statistics, and the rows
+  // must not cross a chunk boundary.
+  void RecordFrameStats(const MatrixBase<BaseFloat> &feats,
+                        const std::vector<bool> &silence_decisions,
+                        int32 offset);
+
+  // Computes the noise vector from the given counts, sums and scaling
+  // factors; this does not touch the scatter statistics.
+  void ComputeVector(double num_speech, double num_noise,
+                     const VectorBase<double> &speech_sum,
+                     const VectorBase<double> &noise_sum,
+                     double r_s, double r_n,
+                     VectorBase<BaseFloat> *vector) const;
+
   // This function updates current_nvector_  (which is our present estimate)
   // of the  current value for the n-vector, after a new chunk of 
-  // data is seen. It takes as argument the silence decisions made by the 
-  // GmmDecoder.
-  void UpdateVector(
-      SubMatrix<BaseFloat> &feats,
-      std::vector<bool> &silence_decisions);
+  // data is seen, from the statistics accumulated so far.
+  void UpdateVector();
 
   // This function updates the scaling parameters r_s and r_n of the 
   // noise estimation model. This is done by maximizing the EM
   // objective. The derivation is not shown here.
-  void UpdateScalingParams(
-      SubMatrix<BaseFloat> &feats,
-      std::vector<bool> &silence_decisions);
+  void UpdateScalingParams();
+
+  // The matrices that UpdateVectorsBatch() stacks the terms of the
+  // extractors in (row i for batch[i]). ExtractVectorsBatch() sizes them
+  // once for the whole batch, and each chunk uses their first rows.
+  struct BatchWorkspace {
+    Matrix<double> speech_terms;
+    Matrix<double> noise_means;
+    Matrix<double> noise_terms;
+    Vector<double> speech_scales;
+    Vector<double> noise_scales;
+    Matrix<double> x;
+  };
+
+  // Like UpdateVector(), for several extractors that share the prior
+  // factors, with one batched solve.
+  static void UpdateVectorsBatch(const std::vector<OnlineNoiseVector*> &batch,
+                                 BatchWorkspace *workspace);
+
+  // Called at the end of each chunk: updates the vector and the scaling
+  // parameters, appends the vector to vectors_history_ and applies the
+  // forgetting factor to the statistics.
+  void FinishChunk();
+
+  // The part of FinishChunk() after UpdateVector().
+  void CompleteChunk();
 
-  // This stores the prior parameters that were used to initialize
-  // the noise vectors.
-  OnlineNoisePrior prior_;
+  // Scales the statistics (counts, sums and scatters) by "scale".
+  void ScaleStats(BaseFloat scale);
+
+  // Makes sure vectors_history_ has room for at least "num_vectors"
+  // rows, keeping the ones already stored.
+  void ReserveVectors(int32 num_vectors);
+
+  // The prior parameters that were used to initialize the noise
+  // vectors. Only r_s and r_n are adapted, and we keep those below.
+  // Empty in MLE mode.
+  OnlineNoisePriorFactors prior_;
 
   // This is similar to the ivector_period option used in online
   // ivectors, i.e., it determines the chunk size for which
   // noise vectors are computed.
   int32 period_;
 
+  // Per-frame scale applied to the statistics, 1.0 for no forgetting.
+  BaseFloat forgetting_factor_;
+
   int32 dim_;
 
+  // The scaling factors for speech and noise, initialized from the
+  // prior and updated by UpdateScalingParams().
+  double r_s_;
+  double r_n_;
+
   // This is the current estimate of the noise vector
   Vector<BaseFloat> current_vector_;
 
-  // Online statistic estimate
-  int32 num_speech_;
-  int32 num_noise_;
-  Vector<BaseFloat> speech_sum_;
-  Vector<BaseFloat> noise_sum_;
-  Matrix<BaseFloat> speech_var_;
-  Matrix<BaseFloat> noise_var_;
+  // Online statistic estimate, kept in double precision since it may
+  // be accumulated over hours of data. The counts are doubles because of
+  // the forgetting factor.
+  double num_speech_;
+  double num_noise_;
+  Vector<double> speech_sum_;
+  Vector<double> noise_sum_;
+  // The scatter statistics are not accumulated in MLE mode.
+  Matrix<double> speech_var_;
+  Matrix<double> noise_var_;
+
+  // Streaming state for the current utterance: the number of frames
+  // accepted so far, whether InputFinished() was called, and the vector
+  // estimated at the end of each chunk. Only the first num_vectors_ rows
+  // of vectors_history_ are used; it grows by doubling, so that we
+  // don't allocate for every chunk.
+  int32 num_frames_;
+  bool input_finished_;
+  int32 num_vectors_;
+  Matrix<BaseFloat> vectors_history_;
+
+  // Low-latency mode: row (t % period_) of frame_stats_ holds the
+  // statistics after frame t of the current chunk, laid out as [ N_s,
+  // N_n, r_s, r_n, speech_sum, noise_sum ]; it has period_ rows.
+  bool low_latency_;
+  Matrix<double> frame_stats_;
+
+  // Temporary storage for AccumulateStats(), kept to avoid reallocating
+  // for each chunk.
+  SpeechNoiseStatsWorkspace stats_workspace_;
+
+  // Where to add the time spent in each stage; NULL if not timing.
+  OnlineNoiseVectorTimingInfo *timing_info_;
 };
 
 
@@ -0,0 +1,74 @@
+// ivectorbin/acc-noise-prior-stats.cc
+
+// Copyright 2020  Johns Hopkins University (Author: Desh Raj)
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "base/kaldi-common.h"
+#include "util/common-utils.h"
+#include "ivector/online-noise-vector.h"
+
+int main(int argc, char *argv[]) {
+  using namespace kaldi;
+  typedef kaldi::int32 int32;
+  try {
+    const char *usage =
+        "Accumulate statistics (count, mean and scatter) for estimating a\n"
+        "Noise Prior object, from noise vectors computed from (part of) the\n"
+        "training data. The stats from several jobs can be summed with\n"
+        "sum-noise-prior-stats, and the prior estimated with est-noise-prior.\n"
+        "\n"
+        "Usage:  acc-noise-prior-stats [options] <noise-vector-rspecifier> "
+        "<stats-out>\n"
+        "e.g.: \n"
+        " acc-noise-prior-stats ark:noise_vec.1.ark noise_prior.1.acc\n";
+
+    ParseOptions po(usage);
+
+    bool binary = true, skip_dup_check = false;
+    po.Register("binary", &binary, "Write output in binary mode");
+    po.Register("skip-dup-check", &skip_dup_check, "If true, do not check "
+                "for duplicate utterances (saves keeping the set of keys "
+                "in memory)");
+
+    po.Read(argc, argv);
+
+    if (po.NumArgs() != 2) {
+      po.PrintUsage();
+      exit(1);
+    }
+
+    std::string noise_vec_rspecifier = po.GetArg(1),
+        stats_wxfilename = po.GetArg(2);
+
+    OnlineNoisePriorStats stats;
+    int32 num_err = 0,
+        num_done = AccumulateNoisePriorStats(noise_vec_rspecifier,
+                                             skip_dup_check, &stats,
+                                             &num_err);
+
+    WriteKaldiObject(stats, stats_wxfilename, binary);
+    KALDI_LOG << "Accumulated stats from " << num_done << " noise vectors, "
+              << num_err << " had errors; wrote stats to "
+              << PrintableWxfilename(stats_wxfilename);
+
+    return (num_done != 0 ? 0 : 1);
+  } catch(const std::exception &e) {
+    std::cerr << e.what();
+    return -1;
+  }
+}
@@ -22,8 +22,6 @@
 #include "util/common-utils.h"
 #include "ivector/online-noise-vector.h"
 
-namespace kaldi {
-
 /* This code implements a Bayesian model for online estimation of speech
  * and noise vectors. First, we estimate the prior parameters from the 
  * training data:
@@ -40,34 +38,6 @@ namespace kaldi {
  * in ivector/online-noise-vector.cc.
 */
 
-void ComputeAndSubtractMean(
-    std::map<std::string, Vector<BaseFloat> *> utt2vector,
-    Vector<BaseFloat> *mean_out) {
-  int32 dim = utt2vector.begin()->second->Dim();
-  size_t num_vectors = utt2vector.size();
-  Vector<BaseFloat> mean(dim);
-  std::map<std::string, Vector<BaseFloat> *>::iterator iter;
-  for (iter = utt2vector.begin(); iter != utt2vector.end(); ++iter)
-    mean.AddVec(1.0 / num_vectors, *(iter->second));
-  mean_out->Resize(dim);
-  mean_out->CopyFromVec(mean);
-  for (iter = utt2vector.begin(); iter != utt2vector.end(); ++iter)
-    iter->second->AddVec(-1.0, *mean_out);
-}
-
-void ComputeCovarianceMatrix(
-    std::map<std::string, Vector<BaseFloat> *> &utt2vector,
-    SpMatrix<BaseFloat> *covariance) {
-  KALDI_ASSERT(!utt2vector.empty());
-  std::map<std::string, Vector<BaseFloat> *>::iterator iter;
-  int32 N = utt2vector.size() - 1;
-  for (iter = utt2vector.begin(); iter != utt2vector.end(); ++iter) {
-    Vector<BaseFloat> noise_vec = *(iter->second);
-    covariance->AddVec2(1.0/N, noise_vec);
-  }
-}
-}
-
 int main(int argc, char *argv[]) {
   using namespace kaldi;
   typedef kaldi::int32 int32;
@@ -83,10 +53,13 @@ int main(int argc, char *argv[]) {
 
     ParseOptions po(usage);
 
-    bool binary = true;
+    bool binary = true, skip_dup_check = false;
     float scale = 1;
     po.Register("binary", &binary, "Write output in binary mode");
     po.Register("scale", &scale, "Init value for r_s and r_n");
+    po.Register("skip-dup-check", &skip_dup_check, "If true, do not check "
+                "for duplicate utterances (saves keeping the set of keys "
+                "in memory)");
 
     po.Read(argc, argv);
 
@@ -98,38 +71,24 @@ int main(int argc, char *argv[]) {
     std::string noise_vec_rspecifier = po.GetArg(1),
         noise_prior_wxfilename = po.GetArg(2);
 
-    int32 num_done = 0, num_err = 0, dim = 0;
-
-    SequentialBaseFloatVectorReader noise_vec_reader(noise_vec_rspecifier);
-
-    std::map<std::string, Vector<BaseFloat> *> utt2noise_vec;
-
-    for (; !noise_vec_reader.Done(); noise_vec_reader.Next()) {
-      std::string utt = noise_vec_reader.Key();
-      const Vector<BaseFloat> noise_vector = noise_vec_reader.Value();
-      if (utt2noise_vec.count(utt) != 0) {
-        KALDI_WARN << "Duplicate noise vector found for utterance " << utt
-                   << ", ignoring it.";
-        num_err++;
-        continue;
-      }
-      utt2noise_vec[utt] = new Vector<BaseFloat>(noise_vector);
-      if (dim == 0) {
-        dim = noise_vector.Dim();
-      } else {
-        KALDI_ASSERT(dim == noise_vector.Dim() && "Noise vector dimension mismatch");
-      }      
-      num_done++;
-    }
+    // The mean and covariance are accumulated in a single pass, so we
+    // never hold more than one noise vector in memory.
+    OnlineNoisePriorStats stats;
+    int32 num_err = 0,
+        num_done = AccumulateNoisePriorStats(noise_vec_rspecifier,
+                                             skip_dup_check, &stats,
+                                             &num_err);
+    KALDI_LOG << "Accumulated stats from " << num_done << " noise vectors, "
+              << num_err << " had errors.";
 
     Vector<BaseFloat> mean;
-    ComputeAndSubtractMean(utt2noise_vec, &mean);
+    SpMatrix<BaseFloat> covariance;
+    stats.GetMeanAndCovariance(&mean, &covariance);
     KALDI_LOG << "2-norm of noise vector mean is " << mean.Norm(2.0);
 
-    SpMatrix<BaseFloat> covariance(dim);
-    ComputeCovarianceMatrix(utt2noise_vec, &covariance);
     OnlineNoisePrior noise_prior;
-    noise_prior.EstimatePriorParameters(mean, covariance, dim, scale);
+    noise_prior.EstimatePriorParameters(mean, covariance, stats.Dim(),
+                                        scale);
 
     WriteKaldiObject(noise_prior, noise_prior_wxfilename, binary);
     KALDI_LOG << "Wrote OnlineNoisePrior parameters to "
@@ -0,0 +1,260 @@
+// ivectorbin/compute-noise-vector-multi.cc
+
+// Copyright 2020   Johns Hopkins University (author: Desh Raj)
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "base/kaldi-common.h"
+#include "util/common-utils.h"
+#include "matrix/kaldi-matrix.h"
+#include "ivector/online-noise-vector.h"
+#include "ivector/noise-vector-io.h"
+#include "ivector/noise-frame-classifier.h"
+
+
+int main(int argc, char *argv[]) {
+  try {
+    using namespace kaldi;
+    using kaldi::int32;
+
+    const char *usage =
+        "Computes several kinds of noise vectors from one pass over the\n"
+        "features and targets: NAT vectors (as compute-noise-vector-seltzer),\n"
+        "offline speech and noise means (as compute-noise-vector) and online\n"
+        "MLE and MAP estimates (as compute-noise-vector-online without\n"
+        "--spk2utt). Only the outputs whose wspecifier is given are\n"
+        "computed; the MAP estimates need --noise-prior. The --period and\n"
+        "--compress options apply to the NAT and offline outputs. With\n"
+        "--frame-classifier, <targets-rspecifier> may be '' to classify\n"
+        "the frames instead of using targets.\n"
+        "Usage: compute-noise-vector-multi [options] <feats-rspecifier> "
+        "<targets-rspecifier>\n"
+        "E.g.: compute-noise-vector-multi --nat-wspecifier=ark:nat.ark \\\n"
+        "  --offline-wspecifier=ark:offline.ark --noise-prior=prior.mdl \\\n"
+        "  --online-map-wspecifier=ark:online.ark scp:feats.scp "
+        "scp:targets.scp\n";
+
+    ParseOptions po(usage);
+    std::string nat_wspecifier, offline_wspecifier, online_mle_wspecifier,
+        online_map_wspecifier, noise_prior_rxfilename, classifier_rxfilename;
+    int32 window = 10, online_period = 10, target_subsampling_factor = 1;
+    bool paired_read = false, compact_targets = false;
+    BaseFloat forgetting_factor = 1.0, speech_bias = 0.0;
+    NoiseVectorWriterOptions writer_opts;
+    po.Register("nat-wspecifier", &nat_wspecifier, "wspecifier for NAT "
+                "vectors, the mean of the first and last --window frames.");
+    po.Register("offline-wspecifier", &offline_wspecifier, "wspecifier for "
+                "the means of the speech and noise frames of each "
+                "utterance.");
+    po.Register("online-mle-wspecifier", &online_mle_wspecifier,
+                "wspecifier for online MLE noise vectors, one per "
+                "--online-period frames.");
+    po.Register("online-map-wspecifier", &online_map_wspecifier,
+                "wspecifier for online MAP noise vectors, one per "
+                "--online-period frames; requires --noise-prior.");
+    po.Register("noise-prior", &noise_prior_rxfilename, "The noise prior, "
+                "for --online-map-wspecifier.");
+    po.Register("window", &window, "Number of frames at the start and at "
+                "the end of each utterance averaged for NAT vectors.");
+    po.Register("online-period", &online_period, "Period of the online "
+                "estimates, in frames.");
+    po.Register("forgetting-factor", &forgetting_factor, "Per-frame "
+                "forgetting factor for the online estimates (see "
+                "compute-noise-vector-online).");
+    po.Register("paired-read", &paired_read, "If true, read the features "
+                "and targets in lockstep rather than reading targets with "
+                "random access; both tables must be sorted.");
+    po.Register("compact-targets", &compact_targets, "If true, "
+                "<targets-rspecifier> holds compact targets (run-length "
+                "encoded frame labels) as written by targets-to-labels.");
+    po.Register("target-subsampling-factor", &target_subsampling_factor,
+                "If > 1, the targets are at 1/target-subsampling-factor of "
+                "the feature frame rate (e.g. from lats_to_targets.sh "
+                "--frame-subsampling-factor); each target frame is used for "
+                "that many feature frames.");
+    po.Register("frame-classifier", &classifier_rxfilename, "If set, a "
+                "frame classifier (see train-frame-classifier) used to get "
+                "the silence decisions for utterances without usable "
+                "targets.");
+    po.Register("speech-bias", &speech_bias, "Bias added to the speech "
+                "log-posterior ratio of --frame-classifier.");
+    writer_opts.Register(&po);
+
+    po.Read(argc, argv);
+
+    if (po.NumArgs() != 2) {
+      po.PrintUsage();
+      exit(1);
+    }
+
+    std::string feat_rspecifier = po.GetArg(1),
+        target_rspecifier = po.GetArg(2);
+
+    if (nat_wspecifier.empty() && offline_wspecifier.empty() &&
+        online_mle_wspecifier.empty() && online_map_wspecifier.empty())
+      KALDI_ERR << "No output was requested.";
+    if (online_map_wspecifier.empty() != noise_prior_rxfilename.empty())
+      KALDI_ERR << "--online-map-wspecifier and --noise-prior must be "
+                << "given together.";
+    if (window <= 0 || online_period <= 0 || target_subsampling_factor <= 0)
+      KALDI_ERR << "Invalid --window, --online-period or "
+                << "--target-subsampling-factor.";
+    if (forgetting_factor <= 0.0 || forgetting_factor > 1.0)
+      KALDI_ERR << "Invalid --forgetting-factor " << forgetting_factor;
+
+    bool use_targets = !target_rspecifier.empty();
+    if (!use_targets && classifier_rxfilename.empty())
+      KALDI_ERR << "An empty <targets-rspecifier> requires --frame-classifier.";
+    NoiseFrameClassifier classifier;
+    if (!classifier_rxfilename.empty())
+      ReadKaldiObject(classifier_rxfilename, &classifier);
+
+    OnlineNoisePrior noise_prior_object;
+    MappedOnlineNoisePrior mapped_prior;
+    OnlineNoisePriorFactors noise_prior;
+    if (!noise_prior_rxfilename.empty()) {
+      if (MappedOnlineNoisePrior::IsMappedPriorFile(noise_prior_rxfilename)) {
+        mapped_prior.Open(noise_prior_rxfilename);
+        noise_prior = mapped_prior.Factors();
+      } else {
+        ReadKaldiObject(noise_prior_rxfilename, &noise_prior_object);
+        noise_prior = noise_prior_object.Factors();
+      }
+    }
+
+    SequentialFeatureTargetReader reader(feat_rspecifier, target_rspecifier,
+                                         paired_read, compact_targets);
+    NoiseVectorWriter *nat_writer = (nat_wspecifier.empty() ? NULL :
+        new NoiseVectorWriter(nat_wspecifier, writer_opts));
+    NoiseVectorWriter *offline_writer = (offline_wspecifier.empty() ? NULL :
+        new NoiseVectorWriter(offline_wspecifier, writer_opts));
+    BaseFloatMatrixWriter online_mle_writer(online_mle_wspecifier),
+        online_map_writer(online_map_wspecifier);
+    bool online_mle = !online_mle_wspecifier.empty(),
+        online_map = !online_map_wspecifier.empty();
+
+    int32 num_done = 0, num_err = 0;
+
+    for (; !reader.Done(); reader.Next()) {
+      std::string utt = reader.Key();
+      const Matrix<BaseFloat> &feat = reader.Feats();
+      int32 num_rows = feat.NumRows(), dim = feat.NumCols();
+      if (num_rows == 0) {
+        KALDI_WARN << "Empty feature matrix for utterance " << utt;
+        num_err++;
+        continue;
+      }
+
+      if (nat_writer != NULL) {
+        Matrix<BaseFloat> rows;
+        SelectHeadTailRows(feat, window, window, &rows);
+        Vector<BaseFloat> nat_vector(dim);
+        nat_vector.AddRowSumMat(1.0 / rows.NumRows(), rows, 0.0);
+        nat_writer->Write(utt, num_rows, nat_vector);
+      }
+
+      // The offline and online estimates need the targets. Without usable
+      // targets, the decisions come from the frame classifier, if any.
+      bool need_targets = (offline_writer != NULL || online_mle ||
+                           online_map),
+          has_targets = need_targets && reader.HasTargets();
+      if (need_targets && use_targets && !has_targets) {
+        KALDI_WARN << "No target found for utterance " << utt;
+      } else if (has_targets) {
+        int32 num_target_frames = (compact_targets ?
+                                   NumFramesInLabels(reader.Labels()) :
+                                   reader.Targets().NumRows());
+        if (!CheckNumTargetFrames(utt, num_rows, num_target_frames,
+                                  target_subsampling_factor, ""))
+          has_targets = false;
+      }
+      if (need_targets && use_targets && !has_targets)
+        num_err++;
+      // The offline and online estimates use the same decisions.
+      std::vector<bool> silence_decisions;
+      bool has_decisions = has_targets;
+      if (has_targets) {
+        if (compact_targets)
+          FrameLabelsToSilenceDecisions(reader.Labels(), &silence_decisions);
+        else
+          TargetsToSilenceDecisions(reader.Targets(), &silence_decisions);
+        SubsampledToFrameDecisions(target_subsampling_factor, num_rows,
+                                   &silence_decisions);
+      } else if (need_targets && !classifier_rxfilename.empty()) {
+        classifier.Classify(feat, speech_bias, &silence_decisions);
+        has_decisions = true;
+      }
+
+      if (offline_writer != NULL) {
+        // Zero if there are no decisions.
+        Vector<double> speech_sum(dim), noise_sum(dim);
+        int32 num_speech = 0, num_noise = 0;
+        if (has_decisions)
+          AccumulateSpeechNoiseStats(feat, silence_decisions, 0,
+                                     &speech_sum, &noise_sum, NULL, NULL,
+                                     &num_speech, &num_noise);
+        if (num_speech > 0) { speech_sum.Scale(1.0/num_speech); }
+        if (num_noise > 0) { noise_sum.Scale(1.0/num_noise); }
+        Vector<BaseFloat> offline_vector(2 * dim);
+        offline_vector.Range(0, dim).CopyFromVec(speech_sum);
+        offline_vector.Range(dim, dim).CopyFromVec(noise_sum);
+        offline_writer->Write(utt, num_rows, offline_vector);
+      }
+
+      if (online_mle || online_map) {
+        // Without decisions, the MAP estimates come from the prior and
+        // the MLE ones are 0.
+        Matrix<BaseFloat> noise_vectors;
+        if (online_mle) {
+          OnlineNoiseVector noise_vec(dim, online_period, forgetting_factor);
+          if (has_decisions)
+            noise_vec.ExtractVectors(feat, silence_decisions, &noise_vectors);
+          else
+            noise_vec.ExtractVectors(feat, &noise_vectors);
+          online_mle_writer.Write(utt, noise_vectors);
+        }
+        if (online_map) {
+          if (noise_prior.FeatDim() != dim)
+            KALDI_ERR << "Feature dimension " << dim << " does not match "
+                      << "the noise prior (" << noise_prior.FeatDim() << ")";
+          OnlineNoiseVector noise_vec(noise_prior, online_period,
+                                      forgetting_factor);
+          if (has_decisions)
+            noise_vec.ExtractVectors(feat, silence_decisions, &noise_vectors);
+          else
+            noise_vec.ExtractVectors(feat, &noise_vectors);
+          online_map_writer.Write(utt, noise_vectors);
+        }
+      }
+      num_done++;
+    }
+
+    delete nat_writer;
+    delete offline_writer;
+
+    KALDI_LOG << "Done computing noise vectors; processed "
+              << num_done << " utterances, "
+              << num_err << " had errors.";
+    if (reader.NumExtraTargets() > 0)
+      KALDI_WARN << reader.NumExtraTargets()
+                 << " targets had no matching features.";
+    return (num_done != 0 ? 0 : 1);
+  } catch(const std::exception &e) {
+    std::cerr << e.what();
+    return -1;
+  }
+}
@@ -19,12 +19,281 @@
 
 
 
+#include <algorithm>
+#include <ctime>
+
 #include "base/kaldi-common.h"
 #include "util/common-utils.h"
+#include "util/kaldi-thread.h"
 #include "matrix/kaldi-matrix.h"
 #include "feat/feature-functions.h"
 #include "ivector/online-noise-vector.h"
+#include "ivector/noise-vector-io.h"
+#include "ivector/noise-frame-classifier.h"
+
+namespace kaldi {
+
+typedef TableWriter<KaldiObjectHolder<OnlineNoiseVectorAdaptationState> >
+    NoiseAdaptationStateWriter;
+typedef RandomAccessTableReader<
+  KaldiObjectHolder<OnlineNoiseVectorAdaptationState> >
+    RandomAccessNoiseAdaptationStateReader;
+
+// Collects what --timing-report prints: the wall-clock and CPU time of
+// each stage, the number of frames, and the latency of each utterance
+// (from when we started reading it until its vectors were written).
+// The stages done in the main thread (reading, decisions) and those
+// done by the tasks (the rest, added in the task destructors, which the
+// TaskSequencer runs one at a time) use different members, so no
+// locking is needed.
+class NoiseVectorTimingReport {
+ public:
+  NoiseVectorTimingReport(): cpu_start_(std::clock()), num_frames_(0) { }
+
+  // Seconds since the start of the job.
+  double Now() const { return job_timer_.Elapsed(); }
+
+  void AddUtterance(int32 num_frames, double latency) {
+    num_frames_ += num_frames;
+    latencies_.push_back(latency);
+  }
+
+  // Writes the report as JSON lines: one line per stage, then a summary.
+  // "frame_shift" (in seconds) is used for the real-time factor.
+  void Write(const std::string &wxfilename, BaseFloat frame_shift) const {
+    Output ko(wxfilename, false);
+    std::ostream &os = ko.Stream();
+    WriteStage("read-features", read_features, os);
+    WriteStage("read-targets", read_targets, os);
+    WriteStage("decisions", decisions, os);
+    WriteStage("accumulate", estimation.accumulate, os);
+    WriteStage("solve", estimation.solve, os);
+    WriteStage("scale-update", estimation.scale_update, os);
+    WriteStage("write", write, os);
+    double wall = Now(),
+        cpu = static_cast<double>(std::clock() - cpu_start_) / CLOCKS_PER_SEC,
+        audio = num_frames_ * frame_shift;
+    std::vector<double> latencies(latencies_);
+    std::sort(latencies.begin(), latencies.end());
+    os << "{\"summary\": true, \"num_utterances\": " << latencies.size()
+       << ", \"num_frames\": " << num_frames_
+       << ", \"wall_seconds\": " << wall
+       << ", \"cpu_seconds\": " << cpu
+       << ", \"frames_per_second\": " << (wall > 0 ? num_frames_ / wall : 0)
+       << ", \"real_time_factor\": " << (audio > 0 ? wall / audio : 0)
+       << ", \"latency_p50_seconds\": " << Percentile(latencies, 0.5)
+       << ", \"latency_p99_seconds\": " << Percentile(latencies, 0.99)
+       << "}\n";
+  }
+
+  NoiseVectorStageTime read_features;
+  NoiseVectorStageTime read_targets;
+  NoiseVectorStageTime decisions;
+  OnlineNoiseVectorTimingInfo estimation;
+  NoiseVectorStageTime write;
+
+ private:
+  static void WriteStage(const char *name, const NoiseVectorStageTime &time,
+                         std::ostream &os) {
+    os << "{\"stage\": \"" << name << "\", \"wall_seconds\": "
+       << time.wall_seconds << ", \"cpu_seconds\": " << time.cpu_seconds
+       << "}\n";
+  }
+
+  // Nearest-rank percentile of sorted values; 0 if there are none.
+  static double Percentile(const std::vector<double> &sorted, double p) {
+    if (sorted.empty())
+      return 0.0;
+    size_t i = static_cast<size_t>(std::ceil(p * sorted.size()));
+    return sorted[i > 0 ? i - 1 : 0];
+  }
+
+  Timer job_timer_;
+  std::clock_t cpu_start_;
+  int64 num_frames_;
+  std::vector<double> latencies_;
+};
+
+// This class computes the online noise vectors for a group of utterances
+// (a single utterance, or all utterances of a speaker in --spk2utt mode,
+// in which case the statistics are carried over between utterances). It
+// is run by a TaskSequencer so that several groups can be processed in
+// parallel. The output is written in the destructor, which the
+// TaskSequencer calls in the same order the tasks were added, so the
+// output archive does not depend on the number of threads.
+class NoiseVectorOnlineTask {
+ public:
+  // If "noise_prior" is NULL, we compute the MLE estimate.
+  // "adaptation_state" may be NULL; if not, estimation starts from
+  // that state. "state_writer" may be NULL; if not, the final state is
+  // written to it under the key "key". "report" may be NULL; if not, the
+  // timing of this task is added to it. If "low_latency" is true, one
+  // vector is output per frame instead of per chunk.
+  NoiseVectorOnlineTask(const OnlineNoisePriorFactors *noise_prior,
+                        int32 period,
+                        BaseFloat forgetting_factor,
+                        bool low_latency,
+                        const std::string &key,
+                        const OnlineNoiseVectorAdaptationState *adaptation_state,
+                        BaseFloatMatrixWriter *writer,
+                        NoiseAdaptationStateWriter *state_writer,
+                        NoiseVectorTimingReport *report):
+      noise_prior_(noise_prior), period_(period),
+      forgetting_factor_(forgetting_factor), low_latency_(low_latency),
+      key_(key),
+      has_state_(adaptation_state != NULL), writer_(writer),
+      state_writer_(state_writer), report_(report) {
+    if (has_state_)
+      state_ = *adaptation_state;
+  }
+
+  // If "silence_decisions" is empty, no usable targets were found: the
+  // vectors are then computed from the prior alone (or set to 0 in
+  // the MLE case). "start_time" is when we started reading the
+  // utterance (see NoiseVectorTimingReport::Now()).
+  void AddUtterance(const std::string &utt,
+                    const Matrix<BaseFloat> &feats,
+                    const std::vector<bool> &silence_decisions,
+                    double start_time) {
+    utts_.push_back(utt);
+    feats_.push_back(feats);
+    silence_decisions_.push_back(silence_decisions);
+    num_frames_.push_back(feats.NumRows());
+    start_times_.push_back(start_time);
+  }
+
+  void operator () () {
+    noise_vectors_.resize(utts_.size());
+    // In the MLE case the dimension comes from the features (or from the
+    // adaptation state, if there are no utterances).
+    int32 feat_dim = (!feats_.empty() ? feats_[0].NumCols() :
+                      state_.speech_sum.Dim());
+    if (noise_prior_ == NULL && feat_dim == 0)
+      return;
+    OnlineNoiseVector *noise_vec = (noise_prior_ != NULL ?
+        new OnlineNoiseVector(*noise_prior_, period_, forgetting_factor_) :
+        new OnlineNoiseVector(feat_dim, period_, forgetting_factor_));
+    if (has_state_)
+      noise_vec->SetAdaptationState(state_);
+    if (report_ != NULL)
+      noise_vec->SetTimingInfo(&timing_info_);
+    noise_vec->SetLowLatency(low_latency_);
+    for (size_t i = 0; i < utts_.size(); i++) {
+      if (silence_decisions_[i].empty()) {
+        noise_vec->ExtractVectors(feats_[i], &(noise_vectors_[i]));
+        if (low_latency_)
+          ExpandToFrames(feats_[i].NumRows(), &(noise_vectors_[i]));
+      } else if (low_latency_) {
+        noise_vec->ExtractFrameVectors(feats_[i], silence_decisions_[i],
+                                       &(noise_vectors_[i]));
+      } else {
+        noise_vec->ExtractVectors(feats_[i], silence_decisions_[i],
+                                  &(noise_vectors_[i]));
+      }
+      feats_[i].Resize(0, 0);
+    }
+    if (state_writer_ != NULL)
+      noise_vec->GetAdaptationState(&state_);
+    delete noise_vec;
+  }
 
+  ~NoiseVectorOnlineTask() {
+    NoiseVectorStageTimer timer(report_ != NULL);
+    for (size_t i = 0; i < utts_.size(); i++) {
+      writer_->Write(utts_[i], noise_vectors_[i]);
+      if (report_ != NULL)
+        report_->AddUtterance(num_frames_[i],
+                              report_->Now() - start_times_[i]);
+    }
+    if (state_writer_ != NULL)
+      state_writer_->Write(key_, state_);
+    if (report_ != NULL) {
+      timer.Stop(&(report_->write));
+      report_->estimation.Add(timing_info_);
+    }
+  }
+
+ private:
+  // Repeats each row of the per-chunk "vectors" for the frames of its
+  // chunk, giving "num_frames" rows.
+  void ExpandToFrames(int32 num_frames, Matrix<BaseFloat> *vectors) const {
+    Matrix<BaseFloat> frame_vectors(num_frames, vectors->NumCols(),
+                                    kUndefined);
+    for (int32 t = 0; t < num_frames; t++)
+      frame_vectors.CopyRowFromVec(vectors->Row(t / period_), t);
+    vectors->Swap(&frame_vectors);
+  }
+
+  const OnlineNoisePriorFactors *noise_prior_;
+  int32 period_;
+  BaseFloat forgetting_factor_;
+  bool low_latency_;
+  std::string key_;
+  bool has_state_;
+  OnlineNoiseVectorAdaptationState state_;
+  std::vector<std::string> utts_;
+  std::vector<Matrix<BaseFloat> > feats_;
+  std::vector<std::vector<bool> > silence_decisions_;
+  std::vector<Matrix<BaseFloat> > noise_vectors_;
+  std::vector<int32> num_frames_;
+  std::vector<double> start_times_;
+  BaseFloatMatrixWriter *writer_;
+  NoiseAdaptationStateWriter *state_writer_;
+  NoiseVectorTimingReport *report_;
+  OnlineNoiseVectorTimingInfo timing_info_;
+};
+
+// Works out the speech/silence decisions for an utterance from its
+// targets, given either as a matrix ("target") or as compact targets
+// ("labels"); both are NULL if none were found. Returns false if no usable
+// targets were found although "expect_targets" is true (i.e. a targets
+// table was given), in which case a warning is printed. The targets may be
+// at 1/target_subsampling_factor of the feature frame rate. If there are no
+// usable targets, the decisions come from "classifier" if it is not NULL,
+// and otherwise "silence_decisions" is left empty.
+bool GetSilenceDecisions(const std::string &utt,
+                         const Matrix<BaseFloat> &feat,
+                         bool prior,
+                         const Matrix<BaseFloat> *target,
+                         const std::vector<std::pair<int32, int32> > *labels,
+                         bool expect_targets,
+                         int32 target_subsampling_factor,
+                         const NoiseFrameClassifier *classifier,
+                         BaseFloat speech_bias,
+                         std::vector<bool> *silence_decisions) {
+  silence_decisions->clear();
+  const char *fallback = (classifier != NULL ?
+                          ". Using the frame classifier." :
+                          (prior ? ". Creating vector from prior estimate." :
+                           ". Setting all to 0s."));
+  bool ok = true;
+  if (target == NULL && labels == NULL) {
+    if (expect_targets) {
+      KALDI_WARN << "No target found for utterance " << utt << fallback;
+      ok = false;
+    }
+  } else {
+    int32 num_target_frames = (labels != NULL ? NumFramesInLabels(*labels) :
+                               target->NumRows());
+    if (!CheckNumTargetFrames(utt, feat.NumRows(), num_target_frames,
+                              target_subsampling_factor, fallback)) {
+      ok = false;
+    } else {
+      if (labels != NULL)
+        FrameLabelsToSilenceDecisions(*labels, silence_decisions);
+      else
+        TargetsToSilenceDecisions(*target, silence_decisions);
+      SubsampledToFrameDecisions(target_subsampling_factor, feat.NumRows(),
+                                 silence_decisions);
+      return true;
+    }
+  }
+  if (classifier != NULL)
+    classifier->Classify(feat, speech_bias, silence_decisions);
+  return ok;
+}
+
+}  // namespace kaldi
 
 int main(int argc, char *argv[]) {
   try {
@@ -38,12 +307,77 @@ int main(int argc, char *argv[]) {
         "value of the _period_ parameter, which is similar to the\n"
         "ivector-period used in online i-vector estimation. If no\n"
         "noise-prior file is provided, we compute an MLE estimate\n"
-        "of the noise vectors\n"
+        "of the noise vectors (the running means of the speech and\n"
+        "silence frames). With --spk2utt, the statistics (and, with\n"
+        "a prior, the adapted scaling factors) are carried over\n"
+        "between the utterances of each speaker, in the order given\n"
+        "in spk2utt. The noise prior may also be in the memory-mapped\n"
+        "format written by copy-noise-prior --mapped=true. With\n"
+        "--frame-classifier, <targets-rspecifier> may be '' to classify\n"
+        "the frames instead of using targets.\n"
         "Usage: compute-noise-vector [options] <feats-rspecifier> "
         " <targets-rspecifier> [<noise-prior>] <period> <matrix-wspecifier>\n"
         "E.g.: compute-noise-vector [options] scp:feats.scp scp:targets.scp [noise-prior] 10 ark:-\n";
 
     ParseOptions po(usage);
+    std::string spk2utt_rspecifier, state_rspecifier, state_wspecifier;
+    bool paired_read = false, compact_targets = false, low_latency = false;
+    BaseFloat forgetting_factor = 1.0, frame_shift = 0.01;
+    std::string timing_report_wxfilename, classifier_rxfilename;
+    BaseFloat speech_bias = 0.0;
+    int32 target_subsampling_factor = 1;
+    TaskSequencerConfig sequencer_config;  // has --num-threads option
+    po.Register("spk2utt", &spk2utt_rspecifier, "rspecifier for "
+                "speaker to utterance-list map; if supplied, the noise "
+                "vector state is carried over between the utterances of "
+                "each speaker.");
+    po.Register("adaptation-state-in", &state_rspecifier, "rspecifier for "
+                "adaptation states to start estimation from, indexed by "
+                "speaker with --spk2utt and by utterance otherwise.");
+    po.Register("adaptation-state-out", &state_wspecifier, "wspecifier for "
+                "the final adaptation states, indexed like "
+                "--adaptation-state-in.");
+    po.Register("paired-read", &paired_read, "If true, read the features "
+                "and targets in lockstep rather than reading targets with "
+                "random access; both tables must be sorted. Not compatible "
+                "with --spk2utt.");
+    po.Register("compact-targets", &compact_targets, "If true, "
+                "<targets-rspecifier> holds compact targets (run-length "
+                "encoded frame labels) as written by targets-to-labels. "
+                "They give the same decisions as the targets they were "
+                "made from.");
+    po.Register("forgetting-factor", &forgetting_factor, "Per-frame "
+                "factor (0 < f <= 1) by which the statistics are scaled "
+                "down as they age, so that the estimate follows changing "
+                "noise conditions; 1.0 means no forgetting, and e.g. 0.999 "
+                "gives an effective window of about 1000 frames.");
+    po.Register("target-subsampling-factor", &target_subsampling_factor,
+                "If > 1, the targets are at 1/target-subsampling-factor of "
+                "the feature frame rate (e.g. from lats_to_targets.sh "
+                "--frame-subsampling-factor); each target frame is used for "
+                "that many feature frames.");
+    po.Register("frame-classifier", &classifier_rxfilename, "If set, a "
+                "frame classifier (see train-frame-classifier) used to get "
+                "the silence decisions for utterances without usable "
+                "targets. <targets-rspecifier> may then be an empty string, "
+                "to use it for all utterances.");
+    po.Register("speech-bias", &speech_bias, "Bias added to the speech "
+                "log-posterior ratio of --frame-classifier; larger values "
+                "classify more frames as speech.");
+    po.Register("low-latency", &low_latency, "If true, output one vector "
+                "per frame, estimated from the frames up to and including "
+                "it, instead of one per <period> frames; the scaling "
+                "factors are still updated every <period> frames.");
+    po.Register("timing-report", &timing_report_wxfilename, "If set, write "
+                "a timing report to this file, as JSON lines: the wall-clock "
+                "and CPU time of each stage (read-features, read-targets, "
+                "decisions, accumulate, solve, scale-update, write), then a "
+                "summary with frames/sec, the real-time factor and the "
+                "p50/p99 per-utterance latency. With --paired-read, "
+                "reading the targets counts as reading the features.");
+    po.Register("frame-shift", &frame_shift, "Frame shift in seconds, used "
+                "for the real-time factor in --timing-report.");
+    sequencer_config.Register(&po);
 
     po.Read(argc, argv);
 
@@ -70,106 +404,163 @@ int main(int argc, char *argv[]) {
       period = std::stoi(po.GetArg(4));
     }
 
-    SequentialBaseFloatMatrixReader feat_reader(feat_rspecifier);
+    if (forgetting_factor <= 0.0 || forgetting_factor > 1.0)
+      KALDI_ERR << "Invalid --forgetting-factor " << forgetting_factor;
+    if (target_subsampling_factor <= 0)
+      KALDI_ERR << "Invalid --target-subsampling-factor "
+                << target_subsampling_factor;
+    bool use_targets = !target_rspecifier.empty();
+    if (!use_targets && classifier_rxfilename.empty())
+      KALDI_ERR << "An empty <targets-rspecifier> requires --frame-classifier.";
+    NoiseFrameClassifier classifier_object;
+    const NoiseFrameClassifier *classifier = NULL;
+    if (!classifier_rxfilename.empty()) {
+      ReadKaldiObject(classifier_rxfilename, &classifier_object);
+      classifier = &classifier_object;
+    }
+    if (paired_read && !spk2utt_rspecifier.empty())
+      KALDI_ERR << "--paired-read cannot be used with --spk2utt.";
+
     BaseFloatMatrixWriter matrix_writer(matrix_wspecifier);
-    RandomAccessBaseFloatMatrixReader target_reader(target_rspecifier);
-    OnlineNoisePrior noise_prior;
-    if (prior)
-      ReadKaldiObject(noise_prior_rxfilename, &noise_prior);
-
-    int32 num_done = 0, num_err = 0;
-
-    for (;!feat_reader.Done(); feat_reader.Next()) {
-      std::string utt = feat_reader.Key();
-      const Matrix<BaseFloat> &feat = feat_reader.Value();
-      if (feat.NumRows() == 0) {
-        KALDI_WARN << "Empty feature matrix for utterance " << utt;
-        num_err++;
-        continue;
+    RandomAccessNoiseAdaptationStateReader state_reader(state_rspecifier);
+    NoiseAdaptationStateWriter state_writer(state_wspecifier);
+    // The prior is either read as a Kaldi object, or, if it was written
+    // with copy-noise-prior --mapped=true, mapped read-only into memory.
+    OnlineNoisePrior noise_prior_object;
+    MappedOnlineNoisePrior mapped_prior;
+    OnlineNoisePriorFactors noise_prior;
+    if (prior) {
+      if (MappedOnlineNoisePrior::IsMappedPriorFile(noise_prior_rxfilename)) {
+        mapped_prior.Open(noise_prior_rxfilename);
+        noise_prior = mapped_prior.Factors();
+      } else {
+        ReadKaldiObject(noise_prior_rxfilename, &noise_prior_object);
+        noise_prior = noise_prior_object.Factors();
       }
-      Matrix<BaseFloat> noise_vectors;
-      if (prior) {
-        OnlineNoiseVector noise_vec(noise_prior, period);
-
-        if (!target_reader.HasKey(utt)) {
-          KALDI_WARN << "No target found for utterance. Getting noise vector "
-            "from prior estimate." << utt;
-          num_err++;
-          noise_vec.ExtractVectors(feat, &noise_vectors);
-        } else {
-          const Matrix<BaseFloat> &target = target_reader.Value(utt);
-          std::vector<bool> silence_decisions;
+    }
 
-          if (feat.NumRows() != target.NumRows()) {
-            KALDI_WARN << "Mismatch in number for frames " << feat.NumRows()
-                       << " for features and targets " << target.NumRows()
-                       << ", for utterance " << utt
-                       << ". Creating vector from prior estimate.";
+    NoiseVectorTimingReport timing_report;
+    NoiseVectorTimingReport *report = (timing_report_wxfilename.empty() ?
+                                       NULL : &timing_report);
+    bool timing = (report != NULL);
+
+    int32 num_done = 0, num_err = 0, num_extra_targets = 0;
+
+    {
+      TaskSequencer<NoiseVectorOnlineTask> sequencer(sequencer_config);
+      if (spk2utt_rspecifier.empty()) {
+        // The reader reads the first utterance when it is opened, so the
+        // timer is started first; the opening is then counted as part of
+        // the first utterance's read time and latency.
+        NoiseVectorStageTimer read_timer(timing);
+        SequentialFeatureTargetReader reader(feat_rspecifier,
+                                             target_rspecifier, paired_read,
+                                             compact_targets);
+        for (; !reader.Done(); read_timer.Reset(), reader.Next()) {
+          std::string utt = reader.Key();
+          const Matrix<BaseFloat> &feat = reader.Feats();
+          double start_time = (timing ? timing_report.Now() -
+                               read_timer.Stop(&(report->read_features)) : 0.0);
+          if (feat.NumRows() == 0) {
+            KALDI_WARN << "Empty feature matrix for utterance " << utt;
             num_err++;
-            noise_vec.ExtractVectors(feat, &noise_vectors);
-          } else {
-            for (int32 i = 0; i < feat.NumRows(); i++) {
-              silence_decisions.push_back(target(i,0) > target(i,1) || 
-                  target(i,2) > target(i,1));
-            }
-            noise_vec.ExtractVectors(feat, silence_decisions, &noise_vectors);
+            continue;
           }
+          const OnlineNoiseVectorAdaptationState *state = NULL;
+          if (!state_rspecifier.empty() && state_reader.HasKey(utt))
+            state = &(state_reader.Value(utt));
+          NoiseVectorOnlineTask *task = new NoiseVectorOnlineTask(
+              (prior ? &noise_prior : NULL), period, forgetting_factor,
+              low_latency, utt, state,
+              &matrix_writer, (state_wspecifier.empty() ? NULL : &state_writer),
+              report);
+          std::vector<bool> silence_decisions;
+          NoiseVectorStageTimer target_timer(timing);
+          bool has_targets = reader.HasTargets();
+          const Matrix<BaseFloat> *target =
+              (has_targets && !compact_targets ? &(reader.Targets()) : NULL);
+          const std::vector<std::pair<int32, int32> > *labels =
+              (has_targets && compact_targets ? &(reader.Labels()) : NULL);
+          target_timer.Stop(timing ? &(report->read_targets) : NULL);
+          NoiseVectorStageTimer decision_timer(timing);
+          if (!GetSilenceDecisions(utt, feat, prior, target, labels,
+                                   use_targets, target_subsampling_factor,
+                                   classifier, speech_bias,
+                                   &silence_decisions))
+            num_err++;
+          decision_timer.Stop(timing ? &(report->decisions) : NULL);
+          task->AddUtterance(utt, feat, silence_decisions, start_time);
+          sequencer.Run(task);
+          num_done++;
         }
+        num_extra_targets = reader.NumExtraTargets();
       } else {
-        int32 num_vectors = (feat.NumRows() + period -1)/period, 
-              dim = 2*feat.NumCols();
-        noise_vectors.Resize(num_vectors, dim, kSetZero);
-        // No prior provided. We compute MLE estimate.
-        if (!target_reader.HasKey(utt)) {
-          KALDI_WARN << "No target found for utterance. Setting all to 0s." << utt;
-          num_err++;
-        } else {
-          const Matrix<BaseFloat> &target = target_reader.Value(utt);
-          int32 j = 0, num_speech = 0, num_noise = 0;
-          Vector<BaseFloat> speech_sum(dim/2), noise_sum(dim/2);
-          speech_sum.SetZero();
-          noise_sum.SetZero();
-          for (int32 i = 0; i < feat.NumRows(); ++i) {
-            bool is_sil = (target(i,0) > target(i,1) || target(i,2) > target(i,1));
-            if (is_sil) {
-              noise_sum.AddVec(1.0, feat.Row(i));
-              num_noise += 1;
-            } else {
-              speech_sum.AddVec(1.0, feat.Row(i));
-              num_speech += 1;
+        SequentialTokenVectorReader spk2utt_reader(spk2utt_rspecifier);
+        RandomAccessBaseFloatMatrixReader feat_reader(feat_rspecifier);
+        RandomAccessBaseFloatMatrixReader target_reader(
+            compact_targets ? "" : target_rspecifier);
+        RandomAccessInt32PairVectorReader label_reader(
+            compact_targets ? target_rspecifier : "");
+        for (; !spk2utt_reader.Done(); spk2utt_reader.Next()) {
+          std::string spk = spk2utt_reader.Key();
+          const std::vector<std::string> &uttlist = spk2utt_reader.Value();
+          const OnlineNoiseVectorAdaptationState *state = NULL;
+          if (!state_rspecifier.empty() && state_reader.HasKey(spk))
+            state = &(state_reader.Value(spk));
+          NoiseVectorOnlineTask *task = new NoiseVectorOnlineTask(
+              (prior ? &noise_prior : NULL), period, forgetting_factor,
+              low_latency, spk, state,
+              &matrix_writer,
+              (state_wspecifier.empty() ? NULL : &state_writer), report);
+          for (size_t i = 0; i < uttlist.size(); i++) {
+            const std::string &utt = uttlist[i];
+            double start_time = (timing ? timing_report.Now() : 0.0);
+            NoiseVectorStageTimer read_timer(timing);
+            if (!feat_reader.HasKey(utt)) {
+              KALDI_WARN << "No features present for utterance " << utt;
+              num_err++;
+              continue;
             }
-            if ((i+1)%period == 0) {
-              Vector<BaseFloat> current_vector(dim);
-              SubVector<BaseFloat> current_speech_vec(current_vector, 0, dim/2);
-              SubVector<BaseFloat> current_noise_vec(current_vector, dim/2, dim/2);
-              if (num_speech > 0)
-                current_speech_vec.AddVec(1.0/num_speech, speech_sum);
-              if (num_noise > 0)
-                current_noise_vec.AddVec(1.0/num_noise, noise_sum);
-              noise_vectors.CopyRowFromVec(current_vector, j);
-              j += 1;
+            const Matrix<BaseFloat> &feat = feat_reader.Value(utt);
+            read_timer.Stop(timing ? &(report->read_features) : NULL);
+            if (feat.NumRows() == 0) {
+              KALDI_WARN << "Empty feature matrix for utterance " << utt;
+              num_err++;
+              continue;
             }
+            std::vector<bool> silence_decisions;
+            const Matrix<BaseFloat> *target = NULL;
+            const std::vector<std::pair<int32, int32> > *labels = NULL;
+            NoiseVectorStageTimer target_timer(timing);
+            if (use_targets && compact_targets && label_reader.HasKey(utt))
+              labels = &(label_reader.Value(utt));
+            else if (use_targets && !compact_targets &&
+                     target_reader.HasKey(utt))
+              target = &(target_reader.Value(utt));
+            target_timer.Stop(timing ? &(report->read_targets) : NULL);
+            NoiseVectorStageTimer decision_timer(timing);
+            if (!GetSilenceDecisions(utt, feat, prior, target, labels,
+                                     use_targets, target_subsampling_factor,
+                                     classifier, speech_bias,
+                                     &silence_decisions))
+              num_err++;
+            decision_timer.Stop(timing ? &(report->decisions) : NULL);
+            task->AddUtterance(utt, feat, silence_decisions, start_time);
+            num_done++;
           }
-          // Last few frames that were not handled in the loop above
-          if (j < num_vectors) {
-            Vector<BaseFloat> current_vector(dim);
-            SubVector<BaseFloat> current_speech_vec(current_vector, 0, dim/2);
-            SubVector<BaseFloat> current_noise_vec(current_vector, dim/2, dim/2);
-            if (num_speech > 0)
-              current_speech_vec.AddVec(1.0/num_speech, speech_sum);
-            if (num_noise > 0)
-              current_noise_vec.AddVec(1.0/num_noise, noise_sum);
-            noise_vectors.CopyRowFromVec(current_vector, j);
-          }
+          sequencer.Run(task);
         }
       }
-      matrix_writer.Write(utt, noise_vectors);
-      num_done++;
+      // The sequencer's destructor waits for all the tasks to finish.
     }
 
     KALDI_LOG << "Done computing average noise frames; processed "
               << num_done << " utterances, "
               << num_err << " had errors.";
+    if (num_extra_targets > 0)
+      KALDI_WARN << num_extra_targets << " targets had no matching features.";
+    if (timing)
+      timing_report.Write(timing_report_wxfilename, frame_shift);
     return (num_done != 0 ? 0 : 1);
   } catch(const std::exception &e) {
     std::cerr << e.what();
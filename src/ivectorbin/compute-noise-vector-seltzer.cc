@@ -23,6 +23,7 @@
 #include "util/common-utils.h"
 #include "matrix/kaldi-matrix.h"
 #include "feat/feature-functions.h"
+#include "ivector/noise-vector-io.h"
 
 
 int main(int argc, char *argv[]) {
@@ -32,12 +33,28 @@ int main(int argc, char *argv[]) {
 
     const char *usage =
         "Compute a NAT vector or each utterance, by\n"
-        "taking average of first and last 10 frames (see Seltzer et al.)\n"
+        "taking average of the first and last --window frames (see Seltzer\n"
+        "et al.).\n"
+        "With --period, writes instead the matrix used by nnet3 as online\n"
+        "i-vectors (the vector once every <period> frames).\n"
+        "If <feats-rspecifier> is an scp file of archive offsets, only the\n"
+        "first and last frames of each utterance are read from disk.\n"
         "Usage: compute-noise-vector-seltzer [options] <feats-rspecifier> "
         " <vector-wspecifier>\n"
         "E.g.: compute-noise-vector-seltzer [options] scp:feats.scp ark:-\n";
 
     ParseOptions po(usage);
+    int32 window = 10;
+    bool partial_read = true;
+    NoiseVectorWriterOptions writer_opts;
+    po.Register("window", &window, "Number of frames at the start and at "
+                "the end of each utterance that are averaged.");
+    po.Register("partial-read", &partial_read, "If true and "
+                "<feats-rspecifier> is an scp file, read only the frames "
+                "that are needed for entries that are archive offsets "
+                "(other entries are read in full). Options in the "
+                "rspecifier, such as \"p\", are not supported then.");
+    writer_opts.Register(&po);
 
     po.Read(argc, argv);
 
@@ -45,43 +62,82 @@ int main(int argc, char *argv[]) {
       po.PrintUsage();
       exit(1);
     }
+    if (window <= 0)
+      KALDI_ERR << "Invalid --window " << window;
 
     std::string feat_rspecifier, vector_wspecifier;
     feat_rspecifier = po.GetArg(1),
       vector_wspecifier = po.GetArg(2);
 
-    SequentialBaseFloatMatrixReader feat_reader(feat_rspecifier);
-    BaseFloatVectorWriter vector_writer(vector_wspecifier);
-
-    int32 num_done = 0, num_err = 0;
-
-    for (;!feat_reader.Done(); feat_reader.Next()) {
-      std::string utt = feat_reader.Key();
-      const Matrix<BaseFloat> &feat = feat_reader.Value();
-      if (feat.NumRows() == 0) {
-        KALDI_WARN << "Empty feature matrix for utterance " << utt;
-        num_err++;
-        continue;
+    NoiseVectorWriter vector_writer(vector_wspecifier, writer_opts);
+
+    int32 num_done = 0, num_err = 0, num_partial = 0;
+
+    std::string script_rxfilename;
+    RspecifierOptions rspecifier_opts;
+    if (partial_read &&
+        ClassifyRspecifier(feat_rspecifier, &script_rxfilename,
+                           &rspecifier_opts) == kScriptRspecifier) {
+      // The script file is read directly, so none of the rspecifier
+      // options (e.g. "p" to skip unreadable entries) would be honored.
+      if (rspecifier_opts.once || rspecifier_opts.sorted ||
+          rspecifier_opts.called_sorted || rspecifier_opts.permissive ||
+          rspecifier_opts.background)
+        KALDI_ERR << "Options in the rspecifier " << feat_rspecifier
+                  << " are not supported with --partial-read=true; remove "
+                  << "them or use --partial-read=false.";
+      HeadTailRowReader row_reader(window, window);
+      std::vector<std::pair<std::string, std::string> > script;
+      if (!ReadScriptFile(script_rxfilename, true, &script))
+        KALDI_ERR << "Error reading script file " << script_rxfilename;
+      for (size_t i = 0; i < script.size(); i++) {
+        const std::string &utt = script[i].first,
+            &feat_rxfilename = script[i].second;
+        Matrix<BaseFloat> rows;
+        int32 num_rows;
+        if (row_reader.Read(feat_rxfilename, &rows, &num_rows)) {
+          num_partial++;
+        } else {
+          Matrix<BaseFloat> feat;
+          ReadKaldiObject(feat_rxfilename, &feat);
+          SelectHeadTailRows(feat, window, window, &rows);
+          num_rows = feat.NumRows();
+        }
+        if (num_rows == 0) {
+          KALDI_WARN << "Empty feature matrix for utterance " << utt;
+          num_err++;
+          continue;
+        }
+        // Each selected frame is counted once, even if the utterance is
+        // shorter than 2 * window frames.
+        Vector<BaseFloat> noise_feat(rows.NumCols());
+        noise_feat.AddRowSumMat(1.0 / rows.NumRows(), rows, 0.0);
+        vector_writer.Write(utt, num_rows, noise_feat);
+        num_done++;
       }
-      Vector<BaseFloat> noise_feat(feat.NumCols());
-      int32 num_noise = 0;
-
-      for (int32 i = 0; i < feat.NumRows(); i++) {
-        if (i < 10 || i+10 >= feat.NumRows()) {
-          noise_feat.AddVec(1.0, feat.Row(i));
-          num_noise += 1;
+    } else {
+      SequentialBaseFloatMatrixReader feat_reader(feat_rspecifier);
+      for (; !feat_reader.Done(); feat_reader.Next()) {
+        std::string utt = feat_reader.Key();
+        const Matrix<BaseFloat> &feat = feat_reader.Value();
+        if (feat.NumRows() == 0) {
+          KALDI_WARN << "Empty feature matrix for utterance " << utt;
+          num_err++;
+          continue;
         }
+        Matrix<BaseFloat> rows;
+        SelectHeadTailRows(feat, window, window, &rows);
+        Vector<BaseFloat> noise_feat(rows.NumCols());
+        noise_feat.AddRowSumMat(1.0 / rows.NumRows(), rows, 0.0);
+        vector_writer.Write(utt, feat.NumRows(), noise_feat);
+        num_done++;
       }
-      
-      if (num_noise > 0) { noise_feat.Scale(1.0/num_noise); }
-
-      vector_writer.Write(utt, noise_feat);
-      num_done++;
     }
 
     KALDI_LOG << "Done computing NAT vectors; processed "
               << num_done << " utterances, "
-              << num_err << " had errors.";
+              << num_err << " had errors; "
+              << num_partial << " were read partially.";
     return (num_done != 0 ? 0 : 1);
   } catch(const std::exception &e) {
     std::cerr << e.what();
@@ -23,6 +23,9 @@
 #include "util/common-utils.h"
 #include "matrix/kaldi-matrix.h"
 #include "feat/feature-functions.h"
+#include "ivector/online-noise-vector.h"
+#include "ivector/noise-vector-io.h"
+#include "ivector/noise-frame-classifier.h"
 
 
 int main(int argc, char *argv[]) {
@@ -35,12 +38,40 @@ int main(int argc, char *argv[]) {
         "taking average of frames segmented into silence and garbage,\n"
         "and mean of speech frames, and concatenating. If no target specifier\n"
         "is provided, then it returns average over all frames in\n"
-        "the utterance."
+        "the utterance. With --period, writes instead the matrix used by\n"
+        "nnet3 as online i-vectors (the vector once every <period> frames).\n"
+        "With --frame-classifier, <targets-rspecifier> may be '' to classify\n"
+        "the frames instead of using targets.\n"
         "Usage: compute-noise-vector [options] <feats-rspecifier> "
         " <targets-rspecifier> <vector-wspecifier>\n"
-        "E.g.: compute-noise-vector [options] scp:feats.scp scp:targets.scp ark:-\n";
+        "E.g.: compute-noise-vector [options] scp:feats.scp scp:targets.scp ark:-\n"
+        "or: compute-noise-vector --period=10 --compress=true scp:feats.scp\n"
+        "  scp:targets.scp ark,scp:ivector_online.ark,ivector_online.scp\n";
 
     ParseOptions po(usage);
+    bool paired_read = false, compact_targets = false;
+    NoiseVectorWriterOptions writer_opts;
+    std::string classifier_rxfilename;
+    BaseFloat speech_bias = 0.0;
+    int32 target_subsampling_factor = 1;
+    po.Register("paired-read", &paired_read, "If true, read the features "
+                "and targets in lockstep rather than reading targets with "
+                "random access; both tables must be sorted.");
+    po.Register("compact-targets", &compact_targets, "If true, "
+                "<targets-rspecifier> holds compact targets (run-length "
+                "encoded frame labels) as written by targets-to-labels.");
+    po.Register("target-subsampling-factor", &target_subsampling_factor,
+                "If > 1, the targets are at 1/target-subsampling-factor of "
+                "the feature frame rate (e.g. from lats_to_targets.sh "
+                "--frame-subsampling-factor); each target frame is used for "
+                "that many feature frames.");
+    po.Register("frame-classifier", &classifier_rxfilename, "If set, a "
+                "frame classifier (see train-frame-classifier) used to get "
+                "the silence decisions for utterances without usable "
+                "targets.");
+    po.Register("speech-bias", &speech_bias, "Bias added to the speech "
+                "log-posterior ratio of --frame-classifier.");
+    writer_opts.Register(&po);
     po.Read(argc, argv);
 
     if (po.NumArgs() != 3) {
@@ -53,61 +84,84 @@ int main(int argc, char *argv[]) {
       target_rspecifier = po.GetArg(2),
       vector_wspecifier = po.GetArg(3);
 
-    SequentialBaseFloatMatrixReader feat_reader(feat_rspecifier);
-    BaseFloatVectorWriter vector_writer(vector_wspecifier);
-    RandomAccessBaseFloatMatrixReader target_reader(target_rspecifier);
+    if (target_subsampling_factor <= 0)
+      KALDI_ERR << "Invalid --target-subsampling-factor "
+                << target_subsampling_factor;
+    bool use_targets = !target_rspecifier.empty();
+    if (!use_targets && classifier_rxfilename.empty())
+      KALDI_ERR << "An empty <targets-rspecifier> requires --frame-classifier.";
+    NoiseFrameClassifier classifier;
+    if (!classifier_rxfilename.empty())
+      ReadKaldiObject(classifier_rxfilename, &classifier);
+
+    SequentialFeatureTargetReader reader(feat_rspecifier, target_rspecifier,
+                                         paired_read, compact_targets);
+    NoiseVectorWriter vector_writer(vector_wspecifier, writer_opts);
 
     int32 num_done = 0, num_err = 0;
 
-    for (;!feat_reader.Done(); feat_reader.Next()) {
-      std::string utt = feat_reader.Key();
-      const Matrix<BaseFloat> &feat = feat_reader.Value();
+    for (;!reader.Done(); reader.Next()) {
+      std::string utt = reader.Key();
+      const Matrix<BaseFloat> &feat = reader.Feats();
       if (feat.NumRows() == 0) {
         KALDI_WARN << "Empty feature matrix for utterance " << utt;
         num_err++;
         continue;
       }
-      Vector<BaseFloat> speech_feat(feat.NumCols());
-      Vector<BaseFloat> noise_feat(feat.NumCols());
+      Vector<double> speech_sum(feat.NumCols());
+      Vector<double> noise_sum(feat.NumCols());
       int32 num_speech = 0, num_noise = 0;
-      
-      if (!target_reader.HasKey(utt)) {
-        KALDI_WARN << "No target found for utterance. Creating vector of 0s. " << utt;
-        num_err++;
+      std::vector<bool> silence_decisions;
+
+      if (!reader.HasTargets()) {
+        if (use_targets) {
+          KALDI_WARN << "No target found for utterance " << utt
+                     << (classifier_rxfilename.empty() ?
+                         ". Creating vector of 0s." :
+                         ". Using the frame classifier.");
+          num_err++;
+        }
       } else {
-        const Matrix<BaseFloat> &target = target_reader.Value(utt);
-
-        if (feat.NumRows() != target.NumRows()) {
-          KALDI_WARN << "Mismatch in number for frames " << feat.NumRows()
-                     << " for features and targets " << target.NumRows()
-                     << ", for utterance " << utt
-                     << ". Creating vector of 0s.";
+        int32 num_target_frames = (compact_targets ?
+                                   NumFramesInLabels(reader.Labels()) :
+                                   reader.Targets().NumRows());
+        if (!CheckNumTargetFrames(utt, feat.NumRows(), num_target_frames,
+                                  target_subsampling_factor,
+                                  (classifier_rxfilename.empty() ?
+                                   ". Creating vector of 0s." :
+                                   ". Using the frame classifier."))) {
           num_err++;
         } else {
-          for (int32 i = 0; i < feat.NumRows(); i++) {
-            if (target(i,1) > target(i,0) && target(i,1) > target(i,2)) {
-              speech_feat.AddVec(1.0, feat.Row(i));
-              num_speech += 1;
-            } else {
-              noise_feat.AddVec(1.0, feat.Row(i));
-              num_noise += 1;
-            }
-          }
+          if (compact_targets)
+            FrameLabelsToSilenceDecisions(reader.Labels(), &silence_decisions);
+          else
+            TargetsToSilenceDecisions(reader.Targets(), &silence_decisions);
+          SubsampledToFrameDecisions(target_subsampling_factor,
+                                     feat.NumRows(), &silence_decisions);
         }
       }
-      if (num_speech > 0) { speech_feat.Scale(1.0/num_speech); }
-      if (num_noise > 0) { noise_feat.Scale(1.0/num_noise); }
-
-      speech_feat.Resize(2*feat.NumCols(), kCopyData);
-      SubVector<BaseFloat> noise_subfeat(speech_feat, feat.NumCols(), feat.NumCols());
-      noise_subfeat.CopyFromVec(noise_feat);
-      vector_writer.Write(utt, speech_feat);
+      if (silence_decisions.empty() && !classifier_rxfilename.empty())
+        classifier.Classify(feat, speech_bias, &silence_decisions);
+      if (!silence_decisions.empty())
+        AccumulateSpeechNoiseStats(feat, silence_decisions, 0,
+                                   &speech_sum, &noise_sum, NULL, NULL,
+                                   &num_speech, &num_noise);
+      if (num_speech > 0) { speech_sum.Scale(1.0/num_speech); }
+      if (num_noise > 0) { noise_sum.Scale(1.0/num_noise); }
+
+      Vector<BaseFloat> noise_vector(2*feat.NumCols());
+      noise_vector.Range(0, feat.NumCols()).CopyFromVec(speech_sum);
+      noise_vector.Range(feat.NumCols(), feat.NumCols()).CopyFromVec(noise_sum);
+      vector_writer.Write(utt, feat.NumRows(), noise_vector);
       num_done++;
     }
 
     KALDI_LOG << "Done computing noise vectors; processed "
               << num_done << " utterances, "
               << num_err << " had errors.";
+    if (reader.NumExtraTargets() > 0)
+      KALDI_WARN << reader.NumExtraTargets()
+                 << " targets had no matching features.";
     return (num_done != 0 ? 0 : 1);
   } catch(const std::exception &e) {
     std::cerr << e.what();
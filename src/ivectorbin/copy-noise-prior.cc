@@ -0,0 +1,74 @@
+// ivectorbin/copy-noise-prior.cc
+
+// Copyright 2020  Johns Hopkins University (Author: Desh Raj)
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "base/kaldi-common.h"
+#include "util/common-utils.h"
+#include "ivector/online-noise-vector.h"
+
+int main(int argc, char *argv[]) {
+  using namespace kaldi;
+  try {
+    const char *usage =
+        "Copy a Noise Prior object, e.g. to convert between binary and\n"
+        "text mode. With --mapped=true the output is written in the\n"
+        "memory-mappable format (including the precomputed factorization\n"
+        "used by the online update), which compute-noise-vector-online maps\n"
+        "read-only instead of reading, so that many processes can start\n"
+        "instantly and share one copy of the prior. The output must then\n"
+        "be a regular file, and is only readable on machines with the same\n"
+        "byte order.\n"
+        "\n"
+        "Usage:  copy-noise-prior [options] <noise-prior-in> <noise-prior-out>\n"
+        "e.g.: \n"
+        " copy-noise-prior --mapped=true noise_prior noise_prior.map\n";
+
+    ParseOptions po(usage);
+
+    bool binary = true, mapped = false;
+    po.Register("binary", &binary, "Write output in binary mode");
+    po.Register("mapped", &mapped, "Write output in the memory-mappable "
+                "format");
+
+    po.Read(argc, argv);
+
+    if (po.NumArgs() != 2) {
+      po.PrintUsage();
+      exit(1);
+    }
+
+    std::string noise_prior_rxfilename = po.GetArg(1),
+        noise_prior_wxfilename = po.GetArg(2);
+
+    OnlineNoisePrior noise_prior;
+    ReadKaldiObject(noise_prior_rxfilename, &noise_prior);
+
+    if (mapped)
+      noise_prior.WriteMapped(noise_prior_wxfilename);
+    else
+      WriteKaldiObject(noise_prior, noise_prior_wxfilename, binary);
+    KALDI_LOG << "Wrote OnlineNoisePrior parameters to "
+              << PrintableWxfilename(noise_prior_wxfilename);
+
+    return 0;
+  } catch(const std::exception &e) {
+    std::cerr << e.what();
+    return -1;
+  }
+}
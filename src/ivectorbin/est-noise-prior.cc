@@ -0,0 +1,75 @@
+// ivectorbin/est-noise-prior.cc
+
+// Copyright 2020  Johns Hopkins University (Author: Desh Raj)
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "base/kaldi-common.h"
+#include "util/common-utils.h"
+#include "ivector/online-noise-vector.h"
+
+int main(int argc, char *argv[]) {
+  using namespace kaldi;
+  try {
+    const char *usage =
+        "Estimate a Noise Prior object from the statistics accumulated by\n"
+        "acc-noise-prior-stats (and summed by sum-noise-prior-stats). This\n"
+        "gives the same result as compute-noise-prior on the same vectors.\n"
+        "\n"
+        "Usage:  est-noise-prior [options] <stats-in> <noise-prior-out>\n"
+        "e.g.: \n"
+        " est-noise-prior noise_prior.acc noise_prior\n";
+
+    ParseOptions po(usage);
+
+    bool binary = true;
+    float scale = 1;
+    po.Register("binary", &binary, "Write output in binary mode");
+    po.Register("scale", &scale, "Init value for r_s and r_n");
+
+    po.Read(argc, argv);
+
+    if (po.NumArgs() != 2) {
+      po.PrintUsage();
+      exit(1);
+    }
+
+    std::string stats_rxfilename = po.GetArg(1),
+        noise_prior_wxfilename = po.GetArg(2);
+
+    OnlineNoisePriorStats stats;
+    ReadKaldiObject(stats_rxfilename, &stats);
+    KALDI_LOG << "Read stats with count " << stats.Count();
+
+    Vector<BaseFloat> mean;
+    SpMatrix<BaseFloat> covariance;
+    stats.GetMeanAndCovariance(&mean, &covariance);
+    KALDI_LOG << "2-norm of noise vector mean is " << mean.Norm(2.0);
+
+    OnlineNoisePrior noise_prior;
+    noise_prior.EstimatePriorParameters(mean, covariance, stats.Dim(), scale);
+
+    WriteKaldiObject(noise_prior, noise_prior_wxfilename, binary);
+    KALDI_LOG << "Wrote OnlineNoisePrior parameters to "
+              << PrintableWxfilename(noise_prior_wxfilename);
+
+    return 0;
+  } catch(const std::exception &e) {
+    std::cerr << e.what();
+    return -1;
+  }
+}
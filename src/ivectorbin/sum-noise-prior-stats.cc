@@ -0,0 +1,71 @@
+// ivectorbin/sum-noise-prior-stats.cc
+
+// Copyright 2020  Johns Hopkins University (Author: Desh Raj)
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "base/kaldi-common.h"
+#include "util/common-utils.h"
+#include "ivector/online-noise-vector.h"
+
+int main(int argc, char *argv[]) {
+  using namespace kaldi;
+  typedef kaldi::int32 int32;
+  try {
+    const char *usage =
+        "Sum statistics for estimating a Noise Prior object, as output by\n"
+        "acc-noise-prior-stats (or by this program, so that the summation\n"
+        "can be done as a tree).\n"
+        "\n"
+        "Usage:  sum-noise-prior-stats [options] <stats-in1> <stats-in2> ... "
+        "<stats-inN> <stats-out>\n"
+        "e.g.: \n"
+        " sum-noise-prior-stats 1.acc 2.acc 3.acc noise_prior.acc\n";
+
+    ParseOptions po(usage);
+
+    bool binary = true;
+    po.Register("binary", &binary, "Write output in binary mode");
+
+    po.Read(argc, argv);
+
+    if (po.NumArgs() < 2) {
+      po.PrintUsage();
+      exit(1);
+    }
+
+    std::string stats_wxfilename = po.GetArg(po.NumArgs());
+
+    OnlineNoisePriorStats stats;
+    for (int32 i = 1; i < po.NumArgs(); i++) {
+      std::string stats_rxfilename = po.GetArg(i);
+      bool binary_in;
+      Input ki(stats_rxfilename, &binary_in);
+      stats.Read(ki.Stream(), binary_in, true);  // true == add
+    }
+
+    WriteKaldiObject(stats, stats_wxfilename, binary);
+    KALDI_LOG << "Summed " << (po.NumArgs() - 1) << " stats, total count "
+              << stats.Count() << "; wrote stats to "
+              << PrintableWxfilename(stats_wxfilename);
+
+    return 0;
+  } catch(const std::exception &e) {
+    std::cerr << e.what();
+    return -1;
+  }
+}
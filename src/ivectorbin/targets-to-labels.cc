@@ -0,0 +1,86 @@
+// ivectorbin/targets-to-labels.cc
+
+// Copyright 2020  Johns Hopkins University (Author: Desh Raj)
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "base/kaldi-common.h"
+#include "util/common-utils.h"
+#include "ivector/noise-vector-io.h"
+
+int main(int argc, char *argv[]) {
+  using namespace kaldi;
+  typedef kaldi::int32 int32;
+  try {
+    const char *usage =
+        "Convert speech/silence/garbage targets, as output by\n"
+        "steps/segmentation/lats_to_targets.sh, to compact targets: run-length\n"
+        "encoded frame labels stored as (label, num-frames) pairs, with labels\n"
+        "0 = silence, 1 = speech and 2 = garbage. A frame is labeled speech if\n"
+        "its speech target is strictly the largest (ties count as non-speech, as\n"
+        "in all the noise vector binaries). The output can be given to\n"
+        "compute-noise-vector and compute-noise-vector-online with\n"
+        "--compact-targets=true.\n"
+        "\n"
+        "Usage:  targets-to-labels [options] <targets-rspecifier> "
+        "<labels-wspecifier>\n"
+        "e.g.: \n"
+        " targets-to-labels scp:targets.scp ark,scp:labels.ark,labels.scp\n";
+
+    ParseOptions po(usage);
+
+    po.Read(argc, argv);
+
+    if (po.NumArgs() != 2) {
+      po.PrintUsage();
+      exit(1);
+    }
+
+    std::string targets_rspecifier = po.GetArg(1),
+        labels_wspecifier = po.GetArg(2);
+
+    SequentialBaseFloatMatrixReader targets_reader(targets_rspecifier);
+    Int32PairVectorWriter labels_writer(labels_wspecifier);
+
+    int32 num_done = 0, num_err = 0;
+    int64 num_frames = 0, num_segments = 0;
+
+    for (; !targets_reader.Done(); targets_reader.Next()) {
+      std::string utt = targets_reader.Key();
+      const Matrix<BaseFloat> &targets = targets_reader.Value();
+      if (targets.NumCols() != 3) {
+        KALDI_WARN << "Expected 3 columns in targets for utterance " << utt
+                   << ", got " << targets.NumCols();
+        num_err++;
+        continue;
+      }
+      std::vector<std::pair<int32, int32> > labels;
+      TargetsToFrameLabels(targets, &labels);
+      labels_writer.Write(utt, labels);
+      num_frames += targets.NumRows();
+      num_segments += labels.size();
+      num_done++;
+    }
+
+    KALDI_LOG << "Converted targets for " << num_done << " utterances, "
+              << num_err << " had errors; " << num_frames << " frames in "
+              << num_segments << " segments.";
+    return (num_done != 0 ? 0 : 1);
+  } catch(const std::exception &e) {
+    std::cerr << e.what();
+    return -1;
+  }
+}
@@ -0,0 +1,126 @@
+// ivectorbin/train-frame-classifier.cc
+
+// Copyright 2020   Johns Hopkins University (author: Desh Raj)
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "base/kaldi-common.h"
+#include "util/common-utils.h"
+#include "ivector/noise-frame-classifier.h"
+#include "ivector/noise-vector-io.h"
+
+
+int main(int argc, char *argv[]) {
+  try {
+    using namespace kaldi;
+    using kaldi::int32;
+
+    const char *usage =
+        "Train a speech/non-speech frame classifier from features and\n"
+        "targets (e.g. from steps/segmentation/lats_to_targets.sh). It can\n"
+        "then be given to the noise vector binaries with --frame-classifier\n"
+        "to get the silence decisions for data that has no targets.\n"
+        "Usage: train-frame-classifier [options] <feats-rspecifier> "
+        "<targets-rspecifier> <classifier-out>\n"
+        "E.g.: train-frame-classifier scp:feats.scp scp:targets.scp "
+        "classifier.mdl\n";
+
+    ParseOptions po(usage);
+    bool binary = true, paired_read = false, compact_targets = false;
+    BaseFloat var_floor = 0.01;
+    int32 target_subsampling_factor = 1;
+    po.Register("binary", &binary, "Write output in binary mode");
+    po.Register("var-floor", &var_floor, "Floor on the variances of each "
+                "class, relative to the variance of all the frames.");
+    po.Register("paired-read", &paired_read, "If true, read the features "
+                "and targets in lockstep rather than reading targets with "
+                "random access; both tables must be sorted.");
+    po.Register("compact-targets", &compact_targets, "If true, "
+                "<targets-rspecifier> holds compact targets (run-length "
+                "encoded frame labels) as written by targets-to-labels.");
+    po.Register("target-subsampling-factor", &target_subsampling_factor,
+                "If > 1, the targets are at 1/target-subsampling-factor of "
+                "the feature frame rate (e.g. from lats_to_targets.sh "
+                "--frame-subsampling-factor); each target frame is used for "
+                "that many feature frames.");
+    po.Read(argc, argv);
+
+    if (po.NumArgs() != 3) {
+      po.PrintUsage();
+      exit(1);
+    }
+
+    std::string feat_rspecifier = po.GetArg(1),
+        target_rspecifier = po.GetArg(2),
+        classifier_wxfilename = po.GetArg(3);
+
+    if (target_subsampling_factor <= 0)
+      KALDI_ERR << "Invalid --target-subsampling-factor "
+                << target_subsampling_factor;
+
+    SequentialFeatureTargetReader reader(feat_rspecifier, target_rspecifier,
+                                         paired_read, compact_targets);
+    NoiseFrameClassifierStats stats;
+    int32 num_done = 0, num_err = 0;
+
+    for (; !reader.Done(); reader.Next()) {
+      std::string utt = reader.Key();
+      const Matrix<BaseFloat> &feat = reader.Feats();
+      if (!reader.HasTargets()) {
+        KALDI_WARN << "No target found for utterance " << utt;
+        num_err++;
+        continue;
+      }
+      int32 num_target_frames = (compact_targets ?
+                                 NumFramesInLabels(reader.Labels()) :
+                                 reader.Targets().NumRows());
+      if (!CheckNumTargetFrames(utt, feat.NumRows(), num_target_frames,
+                                target_subsampling_factor, "")) {
+        num_err++;
+        continue;
+      }
+      std::vector<bool> silence_decisions;
+      if (compact_targets)
+        FrameLabelsToSilenceDecisions(reader.Labels(), &silence_decisions);
+      else
+        TargetsToSilenceDecisions(reader.Targets(), &silence_decisions);
+      SubsampledToFrameDecisions(target_subsampling_factor, feat.NumRows(),
+                                 &silence_decisions);
+      if (stats.Dim() == 0)
+        stats = NoiseFrameClassifierStats(feat.NumCols());
+      else if (stats.Dim() != feat.NumCols())
+        KALDI_ERR << "Feature dimension mismatch for utterance " << utt;
+      stats.AccStats(feat, silence_decisions);
+      num_done++;
+    }
+
+    KALDI_LOG << "Accumulated statistics for " << num_done
+              << " utterances, " << num_err << " had errors.";
+    if (num_done == 0)
+      KALDI_ERR << "No statistics were accumulated.";
+
+    NoiseFrameClassifier classifier;
+    classifier.Estimate(stats, var_floor);
+    WriteKaldiObject(classifier, classifier_wxfilename, binary);
+    KALDI_LOG << "Wrote frame classifier to "
+              << PrintableWxfilename(classifier_wxfilename);
+    return 0;
+  } catch(const std::exception &e) {
+    std::cerr << e.what();
+    return -1;
+  }
+}